@@ -0,0 +1,271 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "AoiCover.h"
+#include "BitMask.h"
+#include <algorithm>
+
+namespace
+{
+   const unsigned int sCellSize = 32;
+
+   //a quadtree piece at least this full of selected pixels is read as one rectangle
+   const double sMinimumFill = 0.5;
+
+   //unselected pixels worth reading to save a request
+   const long long sMergeSlack = 4096;
+
+   //rectangles compared with this many of their neighbors in each merge pass
+   const unsigned int sMergeWindow = 8;
+
+   AoiCover::Rectangle unite(const AoiCover::Rectangle& first, const AoiCover::Rectangle& second)
+   {
+      AoiCover::Rectangle rectangle = { std::min(first.mStartRow, second.mStartRow),
+         std::max(first.mEndRow, second.mEndRow), std::min(first.mStartColumn, second.mStartColumn),
+         std::max(first.mEndColumn, second.mEndColumn) };
+      return rectangle;
+   }
+
+   bool isAbove(const AoiCover::Rectangle& first, const AoiCover::Rectangle& second)
+   {
+      return first.mStartRow < second.mStartRow ||
+         (first.mStartRow == second.mStartRow && first.mStartColumn < second.mStartColumn);
+   }
+
+   bool isLeftOf(const AoiCover::Rectangle& first, const AoiCover::Rectangle& second)
+   {
+      return first.mStartColumn < second.mStartColumn ||
+         (first.mStartColumn == second.mStartColumn && first.mStartRow < second.mStartRow);
+   }
+}
+
+//Selected pixel counts and bounds for each cell of the box, with summed counts to total any range of cells at once.
+//Each cell also records which rectangle covers it, so merges can be checked against the others cheaply.
+class AoiCover::Grid
+{
+public:
+   Grid(const BitMask* pPoints, unsigned int startRow, unsigned int endRow, unsigned int startColumn,
+      unsigned int endColumn) :
+      mStartRow(startRow),
+      mStartColumn(startColumn),
+      mRows((endRow - startRow) / sCellSize + 1),
+      mColumns((endColumn - startColumn) / sCellSize + 1),
+      mSums((mRows + 1) * (mColumns + 1), 0),
+      mOwners(mRows * mColumns, -1)
+   {
+      Cell emptyCell = { 0, { endRow, startRow, endColumn, startColumn } };
+      mCells.resize(mRows * mColumns, emptyCell);
+      for (unsigned int row = startRow; row <= endRow; ++row)
+      {
+         Cell* pCells = &mCells[((row - startRow) / sCellSize) * mColumns];
+         for (unsigned int col = startColumn; col <= endColumn; ++col)
+         {
+            if (pPoints->getPixel(col, row))
+            {
+               Cell& cell = pCells[(col - startColumn) / sCellSize];
+               ++cell.mCount;
+               cell.mBounds.mStartRow = std::min(cell.mBounds.mStartRow, row);
+               cell.mBounds.mEndRow = std::max(cell.mBounds.mEndRow, row);
+               cell.mBounds.mStartColumn = std::min(cell.mBounds.mStartColumn, col);
+               cell.mBounds.mEndColumn = std::max(cell.mBounds.mEndColumn, col);
+            }
+         }
+      }
+      for (unsigned int cellRow = 0; cellRow < mRows; ++cellRow)
+      {
+         for (unsigned int cellColumn = 0; cellColumn < mColumns; ++cellColumn)
+         {
+            mSums[(cellRow + 1) * (mColumns + 1) + cellColumn + 1] = mCells[cellRow * mColumns + cellColumn].mCount +
+               mSums[cellRow * (mColumns + 1) + cellColumn + 1] + mSums[(cellRow + 1) * (mColumns + 1) + cellColumn] -
+               mSums[cellRow * (mColumns + 1) + cellColumn];
+         }
+      }
+   }
+
+   unsigned int getRows() const
+   {
+      return mRows;
+   }
+
+   unsigned int getColumns() const
+   {
+      return mColumns;
+   }
+
+   //adds the rectangles for the cells [firstRow, endRow) x [firstColumn, endColumn)
+   void split(unsigned int firstRow, unsigned int endRow, unsigned int firstColumn, unsigned int endColumn,
+      std::vector<Rectangle>& rectangles)
+   {
+      unsigned long long count = mSums[endRow * (mColumns + 1) + endColumn] -
+         mSums[firstRow * (mColumns + 1) + endColumn] - mSums[endRow * (mColumns + 1) + firstColumn] +
+         mSums[firstRow * (mColumns + 1) + firstColumn];
+      if (count == 0)
+      {
+         return;
+      }
+
+      bool first = true;
+      Rectangle bounds = { 0, 0, 0, 0 };
+      for (unsigned int cellRow = firstRow; cellRow < endRow; ++cellRow)
+      {
+         for (unsigned int cellColumn = firstColumn; cellColumn < endColumn; ++cellColumn)
+         {
+            const Cell& cell = mCells[cellRow * mColumns + cellColumn];
+            if (cell.mCount > 0)
+            {
+               bounds = first ? cell.mBounds : unite(bounds, cell.mBounds);
+               first = false;
+            }
+         }
+      }
+
+      bool single = (endRow - firstRow == 1 && endColumn - firstColumn == 1);
+      if (single || count >= sMinimumFill * getArea(bounds))
+      {
+         setOwner(bounds, static_cast<int>(rectangles.size()));
+         rectangles.push_back(bounds);
+         return;
+      }
+
+      unsigned int middleRow = (endRow - firstRow > 1) ? (firstRow + endRow) / 2 : endRow;
+      unsigned int middleColumn = (endColumn - firstColumn > 1) ? (firstColumn + endColumn) / 2 : endColumn;
+      split(firstRow, middleRow, firstColumn, middleColumn, rectangles);
+      if (middleColumn < endColumn)
+      {
+         split(firstRow, middleRow, middleColumn, endColumn, rectangles);
+      }
+      if (middleRow < endRow)
+      {
+         split(middleRow, endRow, firstColumn, middleColumn, rectangles);
+         if (middleColumn < endColumn)
+         {
+            split(middleRow, endRow, middleColumn, endColumn, rectangles);
+         }
+      }
+   }
+
+   //true if the cells of the rectangle belong to nothing but first, second or no rectangle
+   bool isFree(const Rectangle& rectangle, int first, int second) const
+   {
+      for (unsigned int cellRow = (rectangle.mStartRow - mStartRow) / sCellSize;
+         cellRow <= (rectangle.mEndRow - mStartRow) / sCellSize; ++cellRow)
+      {
+         for (unsigned int cellColumn = (rectangle.mStartColumn - mStartColumn) / sCellSize;
+            cellColumn <= (rectangle.mEndColumn - mStartColumn) / sCellSize; ++cellColumn)
+         {
+            int owner = mOwners[cellRow * mColumns + cellColumn];
+            if (owner >= 0 && owner != first && owner != second)
+            {
+               return false;
+            }
+         }
+      }
+      return true;
+   }
+
+   void setOwner(const Rectangle& rectangle, int owner)
+   {
+      for (unsigned int cellRow = (rectangle.mStartRow - mStartRow) / sCellSize;
+         cellRow <= (rectangle.mEndRow - mStartRow) / sCellSize; ++cellRow)
+      {
+         for (unsigned int cellColumn = (rectangle.mStartColumn - mStartColumn) / sCellSize;
+            cellColumn <= (rectangle.mEndColumn - mStartColumn) / sCellSize; ++cellColumn)
+         {
+            mOwners[cellRow * mColumns + cellColumn] = owner;
+         }
+      }
+   }
+
+private:
+   unsigned int mStartRow;
+   unsigned int mStartColumn;
+   unsigned int mRows;
+   unsigned int mColumns;
+   std::vector<Cell> mCells;
+   std::vector<unsigned long long> mSums;
+   std::vector<int> mOwners;
+};
+
+std::vector<AoiCover::Rectangle> AoiCover::getRectangles(const BitMask* pPoints, unsigned int startRow,
+                                                         unsigned int endRow, unsigned int startColumn,
+                                                         unsigned int endColumn)
+{
+   std::vector<Rectangle> rectangles;
+   if (startRow > endRow || startColumn > endColumn)
+   {
+      return rectangles;
+   }
+   if (pPoints == NULL || pPoints->isOutsideSelected())
+   {
+      Rectangle box = { startRow, endRow, startColumn, endColumn };
+      rectangles.push_back(box);
+      return rectangles;
+   }
+
+   Grid grid(pPoints, startRow, endRow, startColumn, endColumn);
+   grid.split(0, grid.getRows(), 0, grid.getColumns(), rectangles);
+
+   //Merge passes alternate between row and column order, each pairing rectangles with their nearest neighbors in
+   //that order, until a pass merges nothing. Merged rectangles take over the cells of both, so the others can be
+   //checked against them through the grid.
+   for (bool merged = true, byRow = true; merged; byRow = !byRow)
+   {
+      std::vector<Rectangle> sorted(rectangles);
+      std::sort(sorted.begin(), sorted.end(), byRow ? isAbove : isLeftOf);
+      rectangles.clear();
+      for (unsigned int index = 0; index < sorted.size(); ++index)
+      {
+         grid.setOwner(sorted[index], static_cast<int>(index));
+      }
+
+      merged = false;
+      std::vector<bool> removed(sorted.size(), false);
+      for (unsigned int first = 0; first < sorted.size(); ++first)
+      {
+         if (removed[first])
+         {
+            continue;
+         }
+         for (unsigned int second = first + 1; second < sorted.size() && second <= first + sMergeWindow; ++second)
+         {
+            if (removed[second])
+            {
+               continue;
+            }
+            Rectangle rectangle = unite(sorted[first], sorted[second]);
+            long long extra = static_cast<long long>(getArea(rectangle) - getArea(sorted[first]) -
+               getArea(sorted[second]));
+            if (extra <= sMergeSlack && grid.isFree(rectangle, first, second))
+            {
+               sorted[first] = rectangle;
+               grid.setOwner(rectangle, static_cast<int>(first));
+               removed[second] = true;
+               merged = true;
+            }
+         }
+      }
+      for (unsigned int index = 0; index < sorted.size(); ++index)
+      {
+         if (!removed[index])
+         {
+            rectangles.push_back(sorted[index]);
+         }
+      }
+   }
+
+   //read in the order the rows are stored
+   std::sort(rectangles.begin(), rectangles.end(), isAbove);
+   return rectangles;
+}
+
+unsigned long long AoiCover::getArea(const Rectangle& rectangle)
+{
+   return static_cast<unsigned long long>(rectangle.mEndRow - rectangle.mStartRow + 1) *
+      (rectangle.mEndColumn - rectangle.mStartColumn + 1);
+}
@@ -0,0 +1,50 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef AOICOVER_H
+#define AOICOVER_H
+
+#include <vector>
+
+class BitMask;
+
+/**
+ * A few disjoint rectangles which together cover every selected pixel of a BitMask, so an AOI of several distant
+ * shapes can be read with one DataRequest per rectangle instead of one for its whole bounding box.
+ *
+ * The box is split as a quadtree over a grid of 32x32 pixel cells until each piece is at least half selected, each
+ * piece is shrunk to its selected pixels, and then pieces are merged wherever the merged rectangle reads only a few
+ * more unselected pixels than the two did, since every extra request costs a seek.
+ */
+class AoiCover
+{
+public:
+   struct Rectangle
+   {
+      unsigned int mStartRow;
+      unsigned int mEndRow;
+      unsigned int mStartColumn;
+      unsigned int mEndColumn;
+   };
+
+   static std::vector<Rectangle> getRectangles(const BitMask* pPoints, unsigned int startRow, unsigned int endRow,
+      unsigned int startColumn, unsigned int endColumn);
+   static unsigned long long getArea(const Rectangle& rectangle);
+
+private:
+   struct Cell
+   {
+      unsigned int mCount;
+      Rectangle mBounds;
+   };
+
+   class Grid;
+};
+
+#endif
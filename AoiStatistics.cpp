@@ -0,0 +1,376 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "AoiStatistics.h"
+#include "BitMask.h"
+#include "DataAccessor.h"
+#include "DataAccessorImpl.h"
+#include "DataRequest.h"
+#include "ObjectResource.h"
+#include "RasterDataDescriptor.h"
+#include "RasterElement.h"
+#include "switchOnEncoding.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+   const unsigned int sTileSize = 64;
+
+   template<typename T>
+   void readValues(T* pRow, unsigned int startColumn, unsigned int endColumn, std::vector<double>& values)
+   {
+      values.resize(endColumn - startColumn + 1);
+      for (unsigned int col = startColumn; col <= endColumn; ++col)
+      {
+         values[col - startColumn] = static_cast<double>(pRow[col]);
+      }
+   }
+}
+
+AoiStatistics::AoiStatistics(RasterElement* pCube, const BadValueMask& mask) :
+   mpCube(pCube),
+   mMask(mask),
+   mRowCount(0),
+   mColumnCount(0),
+   mTileColumns(0),
+   mTotal(0.0),
+   mSumSquares(0.0),
+   mCount(0),
+   mMinimum(0.0),
+   mMaximum(0.0),
+   mChangedPixels(0),
+   mFirstRow(1),
+   mLastRow(0)
+{
+   const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(mpCube->getDataDescriptor());
+   mRowCount = pDesc->getRowCount();
+   mColumnCount = pDesc->getColumnCount();
+   mTileColumns = (mColumnCount + sTileSize - 1) / sTileSize;
+   Tile emptyTile = { std::numeric_limits<double>::max(), -std::numeric_limits<double>::max(), 0, false };
+   mTiles.resize(mTileColumns * ((mRowCount + sTileSize - 1) / sTileSize), emptyTile);
+   mSelection.resize(mRowCount);
+}
+
+bool AoiStatistics::update(const BitMask* pPoints)
+{
+   //only rows selected before or inside the new bounding box can change
+   mChangedPixels = 0;
+   int x1 = 0;
+   int y1 = 0;
+   int x2 = static_cast<int>(mColumnCount) - 1;
+   int y2 = static_cast<int>(mRowCount) - 1;
+   if (pPoints != NULL && !pPoints->isOutsideSelected())
+   {
+      pPoints->getMinimalBoundingBox(x1, y1, x2, y2);
+      x1 = std::max(x1, 0);
+      y1 = std::max(y1, 0);
+      x2 = std::min(x2, static_cast<int>(mColumnCount) - 1);
+      y2 = std::min(y2, static_cast<int>(mRowCount) - 1);
+   }
+   bool anySelected = (x1 <= x2 && y1 <= y2);
+   unsigned int firstRow = mFirstRow;
+   unsigned int lastRow = mLastRow;
+   if (anySelected && firstRow > lastRow)
+   {
+      firstRow = y1;
+      lastRow = y2;
+   }
+   else if (anySelected)
+   {
+      firstRow = std::min(firstRow, static_cast<unsigned int>(y1));
+      lastRow = std::max(lastRow, static_cast<unsigned int>(y2));
+   }
+   mFirstRow = anySelected ? y1 : 1;
+   mLastRow = anySelected ? y2 : 0;
+   if (firstRow > lastRow)
+   {
+      return true;
+   }
+
+   //The selection is compared first, so only the rows and columns where it changed are read from the cube, with
+   //one request per row of tiles.
+   std::vector<Spans> added(lastRow - firstRow + 1);
+   std::vector<Spans> removed(lastRow - firstRow + 1);
+   Spans selected;
+   for (unsigned int row = firstRow; row <= lastRow; ++row)
+   {
+      selected.clear();
+      if (anySelected && row >= static_cast<unsigned int>(y1) && row <= static_cast<unsigned int>(y2))
+      {
+         getSpans(pPoints, row, x1, x2, selected);
+      }
+      subtractSpans(selected, mSelection[row], added[row - firstRow]);
+      subtractSpans(mSelection[row], selected, removed[row - firstRow]);
+      mSelection[row].swap(selected);
+   }
+
+   const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(mpCube->getDataDescriptor());
+   std::vector<double> values;
+   unsigned int tileStart = firstRow;
+   while (tileStart <= lastRow)
+   {
+      unsigned int tileEnd = std::min((tileStart / sTileSize + 1) * sTileSize - 1, lastRow);
+      unsigned int startRow = tileEnd + 1;
+      unsigned int endRow = tileStart;
+      unsigned int startColumn = mColumnCount;
+      unsigned int endColumn = 0;
+      for (unsigned int row = tileStart; row <= tileEnd; ++row)
+      {
+         const Spans& rowAdded = added[row - firstRow];
+         const Spans& rowRemoved = removed[row - firstRow];
+         if (!rowAdded.empty())
+         {
+            startColumn = std::min(startColumn, rowAdded.front().mStart);
+            endColumn = std::max(endColumn, rowAdded.back().mEnd);
+         }
+         if (!rowRemoved.empty())
+         {
+            startColumn = std::min(startColumn, rowRemoved.front().mStart);
+            endColumn = std::max(endColumn, rowRemoved.back().mEnd);
+         }
+         if (!rowAdded.empty() || !rowRemoved.empty())
+         {
+            startRow = std::min(startRow, row);
+            endRow = row;
+         }
+      }
+      tileStart = tileEnd + 1;
+      if (startRow > endRow)
+      {
+         continue;
+      }
+
+      FactoryResource<DataRequest> pRequest;
+      pRequest->setRows(pDesc->getActiveRow(startRow), pDesc->getActiveRow(endRow));
+      pRequest->setColumns(pDesc->getActiveColumn(startColumn), pDesc->getActiveColumn(endColumn));
+      pRequest->setBands(pDesc->getActiveBand(0), pDesc->getActiveBand(0));
+      pRequest->setInterleaveFormat(BSQ);
+      DataAccessor pAcc = mpCube->getDataAccessor(pRequest.release());
+      for (unsigned int row = startRow; row <= endRow; ++row, pAcc->nextRow())
+      {
+         if (!pAcc.isValid())
+         {
+            return false;
+         }
+
+         //the rows start at startColumn
+         const Spans& rowRemoved = removed[row - firstRow];
+         for (Spans::const_iterator span = rowRemoved.begin(); span != rowRemoved.end(); ++span)
+         {
+            switchOnEncoding(pDesc->getDataType(), readValues, pAcc->getRow(), span->mStart - startColumn,
+               span->mEnd - startColumn, values);
+            addValues(values, row, span->mStart, false);
+         }
+         const Spans& rowAdded = added[row - firstRow];
+         for (Spans::const_iterator span = rowAdded.begin(); span != rowAdded.end(); ++span)
+         {
+            switchOnEncoding(pDesc->getDataType(), readValues, pAcc->getRow(), span->mStart - startColumn,
+               span->mEnd - startColumn, values);
+            addValues(values, row, span->mStart, true);
+         }
+      }
+   }
+   return updateTiles();
+}
+
+unsigned int AoiStatistics::getCount() const
+{
+   return mCount;
+}
+
+double AoiStatistics::getMinimum() const
+{
+   return mMinimum;
+}
+
+double AoiStatistics::getMaximum() const
+{
+   return mMaximum;
+}
+
+double AoiStatistics::getMean() const
+{
+   return (mCount == 0) ? 0.0 : mTotal / mCount;
+}
+
+double AoiStatistics::getStandardDeviation() const
+{
+   double mean = getMean();
+   return (mCount == 0) ? 0.0 : sqrt(std::max(mSumSquares / mCount - mean * mean, 0.0));
+}
+
+unsigned int AoiStatistics::getChangedPixelCount() const
+{
+   return mChangedPixels;
+}
+
+void AoiStatistics::getSpans(const BitMask* pPoints, unsigned int row, unsigned int startColumn,
+                             unsigned int endColumn, Spans& spans)
+{
+   for (unsigned int col = startColumn; col <= endColumn; ++col)
+   {
+      if (pPoints != NULL && !pPoints->getPixel(col, row))
+      {
+         continue;
+      }
+      if (spans.empty() || spans.back().mEnd + 1 != col)
+      {
+         Span span = { col, col };
+         spans.push_back(span);
+      }
+      spans.back().mEnd = col;
+   }
+}
+
+void AoiStatistics::subtractSpans(const Spans& first, const Spans& second, Spans& difference)
+{
+   //both lists are sorted and do not overlap themselves
+   difference.clear();
+   Spans::const_iterator other = second.begin();
+   for (Spans::const_iterator span = first.begin(); span != first.end(); ++span)
+   {
+      unsigned int start = span->mStart;
+      while (other != second.end() && other->mEnd < start)
+      {
+         ++other;
+      }
+      for (Spans::const_iterator cut = other; cut != second.end() && cut->mStart <= span->mEnd; ++cut)
+      {
+         if (cut->mStart > start)
+         {
+            Span piece = { start, cut->mStart - 1 };
+            difference.push_back(piece);
+         }
+         start = cut->mEnd + 1;
+         if (cut->mEnd >= span->mEnd)
+         {
+            break;
+         }
+      }
+      if (start <= span->mEnd)
+      {
+         Span piece = { start, span->mEnd };
+         difference.push_back(piece);
+      }
+   }
+}
+
+void AoiStatistics::addValues(const std::vector<double>& values, unsigned int row, unsigned int startColumn, bool add)
+{
+   mChangedPixels += values.size();
+   unsigned int tileRow = (row / sTileSize) * mTileColumns;
+   for (unsigned int index = 0; index < values.size(); ++index)
+   {
+      double value = values[index];
+      if (!mMask.isValid(value))
+      {
+         continue;
+      }
+
+      unsigned int tileIndex = tileRow + (startColumn + index) / sTileSize;
+      Tile& tile = mTiles[tileIndex];
+      if (add)
+      {
+         mTotal += value;
+         mSumSquares += value * value;
+         ++mCount;
+         ++tile.mCount;
+         tile.mMin = std::min(tile.mMin, value);
+         tile.mMax = std::max(tile.mMax, value);
+         continue;
+      }
+
+      mTotal -= value;
+      mSumSquares -= value * value;
+      --mCount;
+      --tile.mCount;
+
+      //a removed extreme leaves the tile's range unknown until it is rescanned
+      if (!tile.mDirty && (value <= tile.mMin || value >= tile.mMax))
+      {
+         tile.mDirty = true;
+         mDirtyTiles.push_back(tileIndex);
+      }
+   }
+   if (mCount == 0)
+   {
+      //nothing left, so no rounding is left either
+      mTotal = 0.0;
+      mSumSquares = 0.0;
+   }
+}
+
+bool AoiStatistics::updateTiles()
+{
+   const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(mpCube->getDataDescriptor());
+   std::vector<double> values;
+   for (std::vector<unsigned int>::const_iterator it = mDirtyTiles.begin(); it != mDirtyTiles.end(); ++it)
+   {
+      Tile& tile = mTiles[*it];
+      tile.mDirty = false;
+      tile.mMin = std::numeric_limits<double>::max();
+      tile.mMax = -std::numeric_limits<double>::max();
+      if (tile.mCount == 0)
+      {
+         continue;
+      }
+
+      unsigned int startRow = (*it / mTileColumns) * sTileSize;
+      unsigned int endRow = std::min(startRow + sTileSize, mRowCount) - 1;
+      unsigned int startColumn = (*it % mTileColumns) * sTileSize;
+      unsigned int endColumn = std::min(startColumn + sTileSize, mColumnCount) - 1;
+      FactoryResource<DataRequest> pRequest;
+      pRequest->setRows(pDesc->getActiveRow(startRow), pDesc->getActiveRow(endRow));
+      pRequest->setColumns(pDesc->getActiveColumn(startColumn), pDesc->getActiveColumn(endColumn));
+      pRequest->setBands(pDesc->getActiveBand(0), pDesc->getActiveBand(0));
+      pRequest->setInterleaveFormat(BSQ);
+      DataAccessor pAcc = mpCube->getDataAccessor(pRequest.release());
+      for (unsigned int row = startRow; row <= endRow; ++row, pAcc->nextRow())
+      {
+         if (!pAcc.isValid())
+         {
+            return false;
+         }
+         for (Spans::const_iterator span = mSelection[row].begin(); span != mSelection[row].end(); ++span)
+         {
+            if (span->mEnd < startColumn || span->mStart > endColumn)
+            {
+               continue;
+            }
+            //the rows start at the tile's first column
+            switchOnEncoding(pDesc->getDataType(), readValues, pAcc->getRow(),
+               std::max(span->mStart, startColumn) - startColumn, std::min(span->mEnd, endColumn) - startColumn, values);
+            for (std::vector<double>::const_iterator value = values.begin(); value != values.end(); ++value)
+            {
+               if (mMask.isValid(*value))
+               {
+                  tile.mMin = std::min(tile.mMin, *value);
+                  tile.mMax = std::max(tile.mMax, *value);
+               }
+            }
+         }
+      }
+   }
+   mDirtyTiles.clear();
+
+   //one pass over the tiles costs far less than reading the pixels again
+   mMinimum = std::numeric_limits<double>::max();
+   mMaximum = -std::numeric_limits<double>::max();
+   for (std::vector<Tile>::const_iterator tile = mTiles.begin(); tile != mTiles.end(); ++tile)
+   {
+      if (tile->mCount > 0)
+      {
+         mMinimum = std::min(mMinimum, tile->mMin);
+         mMaximum = std::max(mMaximum, tile->mMax);
+      }
+   }
+   return true;
+}
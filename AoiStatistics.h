@@ -0,0 +1,82 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef AOISTATISTICS_H
+#define AOISTATISTICS_H
+
+#include "BadValueMask.h"
+#include <vector>
+
+class BitMask;
+class RasterElement;
+
+/**
+ * Statistics of the first band of a raster element over a selection which changes over time.
+ *
+ * update() compares the new selection with the previous one row by row as column spans, and only
+ * reads, adds or removes the pixels which changed, requesting just the rows and columns they span in
+ * each row of tiles. Min and max are kept per 64x64 tile; removing a tile's extreme value rescans
+ * just that tile.
+ */
+class AoiStatistics
+{
+public:
+   AoiStatistics(RasterElement* pCube, const BadValueMask& mask);
+
+   bool update(const BitMask* pPoints);
+
+   unsigned int getCount() const;
+   double getMinimum() const;
+   double getMaximum() const;
+   double getMean() const;
+   double getStandardDeviation() const;
+   unsigned int getChangedPixelCount() const;
+
+private:
+   struct Span
+   {
+      unsigned int mStart;
+      unsigned int mEnd;
+   };
+   typedef std::vector<Span> Spans;
+
+   struct Tile
+   {
+      double mMin;
+      double mMax;
+      unsigned int mCount;
+      bool mDirty;
+   };
+
+   static void getSpans(const BitMask* pPoints, unsigned int row, unsigned int startColumn, unsigned int endColumn,
+      Spans& spans);
+   static void subtractSpans(const Spans& first, const Spans& second, Spans& difference);
+   void addValues(const std::vector<double>& values, unsigned int row, unsigned int startColumn, bool add);
+   bool updateTiles();
+
+   RasterElement* mpCube;
+   BadValueMask mMask;
+   unsigned int mRowCount;
+   unsigned int mColumnCount;
+   unsigned int mTileColumns;
+
+   std::vector<Spans> mSelection;
+   std::vector<Tile> mTiles;
+   double mTotal;
+   double mSumSquares;
+   unsigned int mCount;
+   double mMinimum;
+   double mMaximum;
+   unsigned int mChangedPixels;
+   unsigned int mFirstRow;
+   unsigned int mLastRow;
+   std::vector<unsigned int> mDirtyTiles;
+};
+
+#endif
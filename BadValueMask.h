@@ -0,0 +1,89 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef BADVALUEMASK_H
+#define BADVALUEMASK_H
+
+#include "RasterDataDescriptor.h"
+#include <cmath>
+#include <limits>
+#include <vector>
+
+/**
+ * The sample values to leave out of processing: the bad values of a
+ * RasterDataDescriptor plus an optional, explicitly given no-data value.
+ *
+ * isValid() has no branches, so callers fold it into their row loops
+ * as a compare-and-blend instead of skipping pixels. NaN never equals a
+ * listed value, so it is only left out when setRejectNan() asks for it.
+ */
+class BadValueMask
+{
+public:
+   BadValueMask(const RasterDataDescriptor* pDescriptor, const double* pNoDataValue = NULL) :
+      mRejectNan(false)
+   {
+      if (pDescriptor != NULL)
+      {
+         const std::vector<int>& badValues = pDescriptor->getBadValues();
+         mValues.assign(badValues.begin(), badValues.end());
+      }
+      if (pNoDataValue != NULL)
+      {
+         mValues.push_back(*pNoDataValue);
+      }
+
+      //only whole values in the range of an int can match an integer sample
+      for (std::vector<double>::const_iterator it = mValues.begin(); it != mValues.end(); ++it)
+      {
+         if (*it == std::floor(*it) && *it >= std::numeric_limits<int>::min() && *it <= std::numeric_limits<int>::max())
+         {
+            mIntegerValues.push_back(static_cast<int>(*it));
+         }
+      }
+   }
+
+   void setRejectNan(bool rejectNan)
+   {
+      mRejectNan = rejectNan;
+   }
+
+   bool isEmpty() const
+   {
+      return mValues.empty();
+   }
+
+   bool isValid(double value) const
+   {
+      bool valid = !mRejectNan | (value == value);
+      for (std::vector<double>::const_iterator it = mValues.begin(); it != mValues.end(); ++it)
+      {
+         valid &= (value != *it);
+      }
+      return valid;
+   }
+
+   const std::vector<double>& getValues() const
+   {
+      return mValues;
+   }
+
+   //the values which can match integer samples, for loops which compare them as integers
+   const std::vector<int>& getIntegerValues() const
+   {
+      return mIntegerValues;
+   }
+
+private:
+   std::vector<double> mValues;
+   std::vector<int> mIntegerValues;
+   bool mRejectNan;
+};
+
+#endif
@@ -0,0 +1,581 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "BadValueMask.h"
+#include "BandMath.h"
+#include "StringUtilities.h"
+#include "switchOnEncoding.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+namespace
+{
+   //the operations, each applied to a whole row by applyRow
+   struct Add
+   {
+      static double apply(double left, double right) { return left + right; }
+   };
+
+   struct Subtract
+   {
+      static double apply(double left, double right) { return left - right; }
+   };
+
+   struct Multiply
+   {
+      static double apply(double left, double right) { return left * right; }
+   };
+
+   struct Divide
+   {
+      static double apply(double left, double right) { return left / right; }
+   };
+
+   struct Power
+   {
+      static double apply(double left, double right) { return std::pow(left, right); }
+   };
+
+   struct Minimum
+   {
+      //NaN from a bad sample wins, as it does for the arithmetic operators
+      static double apply(double left, double right) { return (left < right || left != left) ? left : right; }
+   };
+
+   struct Maximum
+   {
+      static double apply(double left, double right) { return (left > right || left != left) ? left : right; }
+   };
+
+   struct Negate
+   {
+      static double apply(double value, double) { return -value; }
+   };
+
+   struct SquareRoot
+   {
+      static double apply(double value, double) { return std::sqrt(value); }
+   };
+
+   struct Absolute
+   {
+      static double apply(double value, double) { return std::fabs(value); }
+   };
+
+   struct Logarithm
+   {
+      static double apply(double value, double) { return std::log(value); }
+   };
+
+   struct Exponent
+   {
+      static double apply(double value, double) { return std::exp(value); }
+   };
+
+   //pValues is the left operand and the result; the right operand is pOperand's row, or the constant without one
+   template<typename Function>
+   void applyRow(double* pValues, const double* pOperand, double constant, unsigned int columnCount)
+   {
+      if (pOperand == NULL)
+      {
+         for (unsigned int col = 0; col < columnCount; ++col)
+         {
+            pValues[col] = Function::apply(pValues[col], constant);
+         }
+      }
+      else
+      {
+         for (unsigned int col = 0; col < columnCount; ++col)
+         {
+            pValues[col] = Function::apply(pValues[col], pOperand[col]);
+         }
+      }
+   }
+
+   template<typename T>
+   void loadBand(T* pData, unsigned int columnCount, const BadValueMask& mask, double* pValues)
+   {
+      const double badValue = std::numeric_limits<double>::quiet_NaN();
+      for (unsigned int col = 0; col < columnCount; ++col)
+      {
+         double value = static_cast<double>(pData[col]);
+         pValues[col] = mask.isValid(value) ? value : badValue;
+      }
+   }
+}
+
+//Recursive descent over the expression text, emitting the program as it goes:
+//   expression := term (('+' | '-') term)*
+//   term       := unary (('*' | '/') unary)*
+//   unary      := '-' unary | power
+//   power      := primary ('^' unary)?
+//   primary    := number | band | function '(' expression (',' expression)? ')' | '(' expression ')'
+class BandMathExpression::Parser
+{
+public:
+   Parser(BandMathExpression& expression, const std::string& text, unsigned int bandCount) :
+      mExpression(expression),
+      mText(text),
+      mPosition(0),
+      mBandCount(bandCount)
+   {
+   }
+
+   bool parse(std::string& error)
+   {
+      if (!parseExpression())
+      {
+         error = mError;
+         return false;
+      }
+      skipSpaces();
+      if (mPosition < mText.size())
+      {
+         error = "Unexpected '" + mText.substr(mPosition, 1) + "' at position " +
+            StringUtilities::toDisplayString(mPosition + 1) + ".";
+         return false;
+      }
+      return true;
+   }
+
+private:
+   void skipSpaces()
+   {
+      while (mPosition < mText.size() && isspace(static_cast<unsigned char>(mText[mPosition])))
+      {
+         ++mPosition;
+      }
+   }
+
+   bool accept(char token)
+   {
+      skipSpaces();
+      if (mPosition < mText.size() && mText[mPosition] == token)
+      {
+         ++mPosition;
+         return true;
+      }
+      return false;
+   }
+
+   bool fail(const std::string& error)
+   {
+      if (mError.empty())
+      {
+         mError = error;
+      }
+      return false;
+   }
+
+   bool parseExpression()
+   {
+      if (!parseTerm())
+      {
+         return false;
+      }
+      for (;;)
+      {
+         if (accept('+'))
+         {
+            if (!parseTerm())
+            {
+               return false;
+            }
+            mExpression.emit(ADD);
+         }
+         else if (accept('-'))
+         {
+            if (!parseTerm())
+            {
+               return false;
+            }
+            mExpression.emit(SUBTRACT);
+         }
+         else
+         {
+            return true;
+         }
+      }
+   }
+
+   bool parseTerm()
+   {
+      if (!parseUnary())
+      {
+         return false;
+      }
+      for (;;)
+      {
+         if (accept('*'))
+         {
+            if (!parseUnary())
+            {
+               return false;
+            }
+            mExpression.emit(MULTIPLY);
+         }
+         else if (accept('/'))
+         {
+            if (!parseUnary())
+            {
+               return false;
+            }
+            mExpression.emit(DIVIDE);
+         }
+         else
+         {
+            return true;
+         }
+      }
+   }
+
+   bool parseUnary()
+   {
+      if (accept('-'))
+      {
+         if (!parseUnary())
+         {
+            return false;
+         }
+         mExpression.emit(NEGATE);
+         return true;
+      }
+      if (!parsePrimary())
+      {
+         return false;
+      }
+      if (accept('^'))
+      {
+         if (!parseUnary())
+         {
+            return false;
+         }
+         mExpression.emit(POWER);
+      }
+      return true;
+   }
+
+   bool parsePrimary()
+   {
+      skipSpaces();
+      if (mPosition >= mText.size())
+      {
+         return fail("The expression ends unexpectedly.");
+      }
+
+      if (accept('('))
+      {
+         if (!parseExpression())
+         {
+            return false;
+         }
+         return accept(')') ? true : fail("A closing parenthesis is missing.");
+      }
+
+      const char* pStart = mText.c_str() + mPosition;
+      if (isdigit(static_cast<unsigned char>(*pStart)) || *pStart == '.')
+      {
+         char* pEnd = NULL;
+         double value = strtod(pStart, &pEnd);
+         if (pEnd == pStart)
+         {
+            return fail("Invalid number at position " + StringUtilities::toDisplayString(mPosition + 1) + ".");
+         }
+         mPosition += static_cast<unsigned int>(pEnd - pStart);
+         mExpression.push(CONSTANT, 0, value);
+         return true;
+      }
+
+      std::string name;
+      while (mPosition < mText.size() && isalnum(static_cast<unsigned char>(mText[mPosition])))
+      {
+         name += static_cast<char>(tolower(static_cast<unsigned char>(mText[mPosition])));
+         ++mPosition;
+      }
+      if (name.empty())
+      {
+         return fail("Unexpected '" + mText.substr(mPosition, 1) + "' at position " +
+            StringUtilities::toDisplayString(mPosition + 1) + ".");
+      }
+
+      if (name.size() > 1 && name[0] == 'b' && name.find_first_not_of("0123456789", 1) == std::string::npos)
+      {
+         unsigned int band = static_cast<unsigned int>(atoi(name.c_str() + 1));
+         if (band < 1 || band > mBandCount)
+         {
+            return fail("Band " + name + " does not exist, the raster element has " +
+               StringUtilities::toDisplayString(mBandCount) + " bands.");
+         }
+         mExpression.push(BAND, band - 1, 0.0);
+         return true;
+      }
+
+      Operation operation = SQRT;
+      bool binary = false;
+      if (name == "sqrt")
+      {
+         operation = SQRT;
+      }
+      else if (name == "abs")
+      {
+         operation = ABS;
+      }
+      else if (name == "log")
+      {
+         operation = LOG;
+      }
+      else if (name == "exp")
+      {
+         operation = EXP;
+      }
+      else if (name == "min" || name == "max")
+      {
+         operation = (name == "min") ? MIN : MAX;
+         binary = true;
+      }
+      else
+      {
+         return fail("Unknown name " + name + ".");
+      }
+
+      if (!accept('(') || !parseExpression())
+      {
+         return fail(name + " needs an argument in parentheses.");
+      }
+      if (binary && (!accept(',') || !parseExpression()))
+      {
+         return fail(name + " needs two arguments.");
+      }
+      if (!accept(')'))
+      {
+         return fail("A closing parenthesis is missing.");
+      }
+      mExpression.emit(operation);
+      return true;
+   }
+
+   BandMathExpression& mExpression;
+   const std::string& mText;
+   unsigned int mPosition;
+   unsigned int mBandCount;
+   std::string mError;
+};
+
+BandMathExpression::BandMathExpression() :
+   mStackDepth(0)
+{
+}
+
+bool BandMathExpression::compile(const std::string& expression, unsigned int bandCount, std::string& error)
+{
+   mProgram.clear();
+   mBands.clear();
+   mStackDepth = 0;
+   Parser parser(*this, expression, bandCount);
+   if (!parser.parse(error))
+   {
+      mProgram.clear();
+      mBands.clear();
+      return false;
+   }
+
+   unsigned int depth = 0;
+   for (std::vector<Instruction>::const_iterator it = mProgram.begin(); it != mProgram.end(); ++it)
+   {
+      if (it->mOperation == PUSH)
+      {
+         mStackDepth = std::max(mStackDepth, ++depth);
+      }
+      else if (it->mSource == STACK && it->mOperation < NEGATE)
+      {
+         --depth;
+      }
+   }
+   return true;
+}
+
+const std::vector<unsigned int>& BandMathExpression::getBands() const
+{
+   return mBands;
+}
+
+const double* BandMathExpression::evaluate(EncodingType type, const std::vector<void*>& bandRows,
+                                           unsigned int columnCount, const BadValueMask& mask, Rows& rows) const
+{
+   //each band is converted once per row, however often the expression uses it
+   rows.mBands.resize(mBands.size());
+   for (unsigned int band = 0; band < mBands.size(); ++band)
+   {
+      rows.mBands[band].resize(columnCount);
+      switchOnEncoding(type, loadBand, bandRows[band], columnCount, mask, &rows.mBands[band][0]);
+   }
+   rows.mStack.resize(mStackDepth);
+   for (unsigned int level = 0; level < mStackDepth; ++level)
+   {
+      rows.mStack[level].resize(columnCount);
+   }
+
+   unsigned int depth = 0;
+   for (std::vector<Instruction>::const_iterator it = mProgram.begin(); it != mProgram.end(); ++it)
+   {
+      if (it->mOperation == PUSH)
+      {
+         std::vector<double>& values = rows.mStack[depth++];
+         if (it->mSource == BAND)
+         {
+            std::copy(rows.mBands[it->mBand].begin(), rows.mBands[it->mBand].end(), values.begin());
+         }
+         else
+         {
+            std::fill(values.begin(), values.end(), it->mValue);
+         }
+         continue;
+      }
+
+      const double* pOperand = NULL;
+      if (it->mSource == BAND)
+      {
+         pOperand = &rows.mBands[it->mBand][0];
+      }
+      else if (it->mSource == STACK && it->mOperation < NEGATE)
+      {
+         pOperand = &rows.mStack[--depth][0];
+      }
+      double* pValues = &rows.mStack[depth - 1][0];
+      switch (it->mOperation)
+      {
+      case ADD:
+         applyRow<Add>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case SUBTRACT:
+         applyRow<Subtract>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case MULTIPLY:
+         applyRow<Multiply>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case DIVIDE:
+         applyRow<Divide>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case POWER:
+         applyRow<Power>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case MIN:
+         applyRow<Minimum>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case MAX:
+         applyRow<Maximum>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case NEGATE:
+         applyRow<Negate>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case SQRT:
+         applyRow<SquareRoot>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case ABS:
+         applyRow<Absolute>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case LOG:
+         applyRow<Logarithm>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      case EXP:
+         applyRow<Exponent>(pValues, pOperand, it->mValue, columnCount);
+         break;
+      default:
+         break;
+      }
+   }
+   return &rows.mStack[0][0];
+}
+
+double BandMathExpression::apply(Operation operation, double left, double right)
+{
+   //evaluates one operation on constants for folding, with the same functions evaluate() applies to rows
+   switch (operation)
+   {
+   case ADD:
+      return Add::apply(left, right);
+   case SUBTRACT:
+      return Subtract::apply(left, right);
+   case MULTIPLY:
+      return Multiply::apply(left, right);
+   case DIVIDE:
+      return Divide::apply(left, right);
+   case POWER:
+      return Power::apply(left, right);
+   case MIN:
+      return Minimum::apply(left, right);
+   case MAX:
+      return Maximum::apply(left, right);
+   case NEGATE:
+      return Negate::apply(left, right);
+   case SQRT:
+      return SquareRoot::apply(left, right);
+   case ABS:
+      return Absolute::apply(left, right);
+   case LOG:
+      return Logarithm::apply(left, right);
+   case EXP:
+      return Exponent::apply(left, right);
+   default:
+      return left;
+   }
+}
+
+void BandMathExpression::emit(Operation operation)
+{
+   unsigned int size = mProgram.size();
+   Instruction instruction = { operation, STACK, 0, 0.0 };
+
+   //constant operands are folded away, and a band or constant right operand is taken directly instead of pushed
+   if (size > 0 && mProgram[size - 1].mOperation == PUSH)
+   {
+      const Instruction& right = mProgram[size - 1];
+      if (operation >= NEGATE)
+      {
+         if (right.mSource == CONSTANT)
+         {
+            mProgram[size - 1].mValue = apply(operation, right.mValue, 0.0);
+            return;
+         }
+      }
+      else if (right.mSource == CONSTANT && size > 1 && mProgram[size - 2].mOperation == PUSH &&
+         mProgram[size - 2].mSource == CONSTANT)
+      {
+         mProgram[size - 2].mValue = apply(operation, mProgram[size - 2].mValue, right.mValue);
+         mProgram.pop_back();
+         return;
+      }
+      else
+      {
+         instruction.mSource = right.mSource;
+         instruction.mBand = right.mBand;
+         instruction.mValue = right.mValue;
+         mProgram.pop_back();
+      }
+   }
+   mProgram.push_back(instruction);
+}
+
+void BandMathExpression::push(Source source, unsigned int band, double value)
+{
+   Instruction instruction = { PUSH, source, 0, value };
+   if (source == BAND)
+   {
+      std::vector<unsigned int>::iterator it = std::find(mBands.begin(), mBands.end(), band);
+      instruction.mBand = static_cast<unsigned int>(it - mBands.begin());
+      if (it == mBands.end())
+      {
+         mBands.push_back(band);
+      }
+   }
+   mProgram.push_back(instruction);
+}
@@ -0,0 +1,91 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef BANDMATH_H
+#define BANDMATH_H
+
+#include "TypesFile.h"
+#include <string>
+#include <vector>
+
+class BadValueMask;
+
+/**
+ * A per-pixel expression of the bands of a raster element, such as "(b4 - b3) / (b4 + b3)".
+ *
+ * Bands are b1, b2 and so on. The operators are + - * / ^ and unary minus, with parentheses and the functions
+ * sqrt, abs, log, exp, min and max. compile() turns the text into a short stack program, folding constants and
+ * letting each operator take a band or constant operand directly. evaluate() then runs the program a whole row
+ * at a time, so the interpreter costs once per instruction per row instead of once per pixel, and nothing but a
+ * few rows of doubles is ever materialized. Bad input samples give NaN.
+ */
+class BandMathExpression
+{
+public:
+   //scratch rows for one evaluating thread
+   struct Rows
+   {
+      std::vector<std::vector<double> > mBands;
+      std::vector<std::vector<double> > mStack;
+   };
+
+   BandMathExpression();
+
+   bool compile(const std::string& expression, unsigned int bandCount, std::string& error);
+
+   const std::vector<unsigned int>& getBands() const;
+   const double* evaluate(EncodingType type, const std::vector<void*>& bandRows, unsigned int columnCount,
+      const BadValueMask& mask, Rows& rows) const;
+
+private:
+   //binary operations come before NEGATE, unary ones from it on
+   enum Operation
+   {
+      PUSH,
+      ADD,
+      SUBTRACT,
+      MULTIPLY,
+      DIVIDE,
+      POWER,
+      MIN,
+      MAX,
+      NEGATE,
+      SQRT,
+      ABS,
+      LOG,
+      EXP
+   };
+
+   //where an instruction's (right hand) operand comes from
+   enum Source
+   {
+      STACK,
+      BAND,
+      CONSTANT
+   };
+
+   struct Instruction
+   {
+      Operation mOperation;
+      Source mSource;
+      unsigned int mBand;
+      double mValue;
+   };
+
+   class Parser;
+   static double apply(Operation operation, double left, double right);
+   void emit(Operation operation);
+   void push(Source source, unsigned int band, double value);
+
+   std::vector<Instruction> mProgram;
+   std::vector<unsigned int> mBands;
+   unsigned int mStackDepth;
+};
+
+#endif
@@ -0,0 +1,61 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef BATCHKERNEL_H
+#define BATCHKERNEL_H
+
+#include <QtCore/QAtomicInt>
+
+class PlugInArgList;
+
+/**
+ * The calculation of one run of a tutorial, split from the parts of the run
+ * which use the Opticks services.
+ *
+ * compute() only reads and writes data through the readers, writers and
+ * accessors which prepareBatch() created for it, and creates no data requests
+ * or accessors of its own, so it can run on any thread. It reports no progress
+ * unless it was given a progress reporter, and stops early once aborted is set.
+ *
+ * The tutorials' abort() sets such a flag, which their calculations and
+ * RowStripWorkers watch rather than isAborted(), as they may not run on the
+ * plug-in's thread and should stop as soon as it is called.
+ */
+class BatchKernel
+{
+public:
+   virtual ~BatchKernel()
+   {
+   }
+
+   virtual bool compute(QAtomicInt& aborted) = 0;
+};
+
+/**
+ * Implemented by the tutorials which Tutorial 7 runs on its pool threads.
+ *
+ * prepareBatch() resolves the inputs, creates any elements and starts the step,
+ * and returns NULL, with the step finalized, if the run cannot go ahead.
+ * finishBatch() finalizes the step and sets the outputs, whether or not
+ * compute() succeeded. Both are only called on the main thread, and
+ * execute() is the same three calls one after the other.
+ */
+class BatchOperation
+{
+public:
+   virtual BatchKernel* prepareBatch(PlugInArgList* pInArgList) = 0;
+   virtual bool finishBatch(BatchKernel* pKernel, PlugInArgList* pOutArgList) = 0;
+
+protected:
+   virtual ~BatchOperation()
+   {
+   }
+};
+
+#endif
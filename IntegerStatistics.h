@@ -0,0 +1,109 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef INTEGERSTATISTICS_H
+#define INTEGERSTATISTICS_H
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+/**
+ * Row statistics of 8 and 16 bit integer samples, accumulated in the samples' own type.
+ *
+ * Min and max are compared as T and totals are summed as int over blocks short enough not to overflow, then
+ * widened to 64 bits, so the loop is plain integer work the compiler can vectorize and totals are exact. Only
+ * the total of each row is converted to double, which stays exact up to 2^53.
+ *
+ * sSupported is false for the other encodings, which keep their double loops.
+ */
+template<typename T>
+struct IntegerStatistics
+{
+   static const bool sSupported = false;
+
+   static void addRow(const T* pData, unsigned int columnCount, const std::vector<int>& badValues,
+      const unsigned char* pSelected, unsigned int* pHistogram, double& min, double& max, double& total,
+      unsigned int& count)
+   {
+   }
+};
+
+template<typename T>
+struct NativeIntegerStatistics
+{
+   static const bool sSupported = true;
+
+   //65535 * 32768 still fits in an int
+   static const unsigned int sBlockSize = 32768;
+
+   //Adds the valid samples of a row: those not in badValues and, if pSelected is given, selected. pHistogram, if
+   //given, has one bin per value of T from its minimum up.
+   static void addRow(const T* pData, unsigned int columnCount, const std::vector<int>& badValues,
+      const unsigned char* pSelected, unsigned int* pHistogram, double& min, double& max, double& total,
+      unsigned int& count)
+   {
+      long long rowTotal = 0;
+      for (unsigned int start = 0; start < columnCount; start += sBlockSize)
+      {
+         unsigned int end = std::min(columnCount, start + sBlockSize);
+         T blockMin = std::numeric_limits<T>::max();
+         T blockMax = std::numeric_limits<T>::min();
+         int blockTotal = 0;
+         unsigned int blockCount = 0;
+         for (unsigned int col = start; col < end; ++col)
+         {
+            T value = pData[col];
+            bool valid = (pSelected == NULL || pSelected[col] != 0);
+            for (std::vector<int>::const_iterator it = badValues.begin(); it != badValues.end(); ++it)
+            {
+               valid &= (static_cast<int>(value) != *it);
+            }
+            blockMin = std::min(blockMin, valid ? value : std::numeric_limits<T>::max());
+            blockMax = std::max(blockMax, valid ? value : std::numeric_limits<T>::min());
+            blockTotal += valid ? value : 0;
+            blockCount += valid;
+            if (pHistogram != NULL)
+            {
+               pHistogram[static_cast<int>(value) - std::numeric_limits<T>::min()] += valid;
+            }
+         }
+         if (blockCount > 0)
+         {
+            min = std::min(min, static_cast<double>(blockMin));
+            max = std::max(max, static_cast<double>(blockMax));
+         }
+         rowTotal += blockTotal;
+         count += blockCount;
+      }
+      total += static_cast<double>(rowTotal);
+   }
+};
+
+template<>
+struct IntegerStatistics<unsigned char> : public NativeIntegerStatistics<unsigned char>
+{
+};
+
+template<>
+struct IntegerStatistics<signed char> : public NativeIntegerStatistics<signed char>
+{
+};
+
+template<>
+struct IntegerStatistics<unsigned short> : public NativeIntegerStatistics<unsigned short>
+{
+};
+
+template<>
+struct IntegerStatistics<signed short> : public NativeIntegerStatistics<signed short>
+{
+};
+
+#endif
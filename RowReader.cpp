@@ -0,0 +1,356 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "DataAccessor.h"
+#include "DataAccessorImpl.h"
+#include "DataRequest.h"
+#include "ObjectResource.h"
+#include "PlugInArgList.h"
+#include "RasterDataDescriptor.h"
+#include "RasterElement.h"
+#include "RowReader.h"
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+   const unsigned int sDefaultRowsPerChunk = 64;
+   const unsigned int sDefaultDepth = 2;
+}
+
+class RowReader::ReaderThread : public QThread
+{
+public:
+   ReaderThread(RowReader& reader) : mReader(reader)
+   {
+   }
+
+protected:
+   virtual void run()
+   {
+      mReader.readAhead();
+   }
+
+private:
+   RowReader& mReader;
+};
+
+RowReader::RowReader(RasterElement* pCube, unsigned int startRow, unsigned int endRow, unsigned int startColumn,
+                     unsigned int endColumn, unsigned int rowsPerChunk, unsigned int depth, unsigned int band) :
+   mpAccessor(NULL),
+   mStartRow(startRow),
+   mStartColumn(startColumn),
+   mRow(startRow),
+   mEndRow(endRow),
+   mRowBytes(0),
+   mRowsPerChunk(rowsPerChunk),
+   mDepth(0),
+   mReadyCount(0),
+   mFailed(false),
+   mStop(false),
+   mReadIndex(0),
+   mRowInChunk(0),
+   mHaveChunk(false),
+   mpThread(NULL)
+{
+   const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(pCube->getDataDescriptor());
+   FactoryResource<DataRequest> pRequest;
+   pRequest->setRows(pDesc->getActiveRow(startRow), pDesc->getActiveRow(endRow));
+   pRequest->setColumns(pDesc->getActiveColumn(startColumn), pDesc->getActiveColumn(endColumn));
+   pRequest->setBands(pDesc->getActiveBand(band), pDesc->getActiveBand(band));
+   pRequest->setInterleaveFormat(BSQ);
+   mRowBytes = (endColumn - startColumn + 1) * pDesc->getBytesPerElement();
+   start(pCube, pRequest.release(), depth);
+}
+
+RowReader::RowReader(RasterElement* pCube, unsigned int startRow, unsigned int endRow, InterleaveFormatType interleave,
+                     unsigned int rowsPerChunk, unsigned int depth) :
+   mpAccessor(NULL),
+   mStartRow(startRow),
+   mStartColumn(0),
+   mRow(startRow),
+   mEndRow(endRow),
+   mRowBytes(0),
+   mRowsPerChunk(rowsPerChunk),
+   mDepth(0),
+   mReadyCount(0),
+   mFailed(false),
+   mStop(false),
+   mReadIndex(0),
+   mRowInChunk(0),
+   mHaveChunk(false),
+   mpThread(NULL)
+{
+   const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(pCube->getDataDescriptor());
+   FactoryResource<DataRequest> pRequest;
+   pRequest->setRows(pDesc->getActiveRow(startRow), pDesc->getActiveRow(endRow));
+   pRequest->setInterleaveFormat(interleave);
+   mRowBytes = pDesc->getColumnCount() * pDesc->getBandCount() * pDesc->getBytesPerElement();
+   start(pCube, pRequest.release(), depth);
+}
+
+void RowReader::start(RasterElement* pCube, DataRequest* pRequest, unsigned int depth)
+{
+   const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(pCube->getDataDescriptor());
+   mpAccessor = new DataAccessor(pCube->getDataAccessor(pRequest));
+
+   //an in-memory cube has nothing to wait for, so copying it ahead would only cost time
+   if (depth > 0 && pDesc->getProcessingLocation() != IN_MEMORY)
+   {
+      mDepth = depth;
+      mRowsPerChunk = std::max(mRowsPerChunk, 1u);
+   }
+}
+
+RowReader::~RowReader()
+{
+   stopReading();
+   delete mpAccessor;
+}
+
+void RowReader::startReading()
+{
+   if (mChunks.empty())
+   {
+      mChunks.resize(mDepth, std::vector<char>(static_cast<size_t>(mRowsPerChunk) * mRowBytes));
+      mChunkRowCounts.resize(mDepth, 0);
+   }
+   mpThread = new ReaderThread(*this);
+   mpThread->start();
+}
+
+void RowReader::stopReading()
+{
+   if (mpThread == NULL)
+   {
+      return;
+   }
+   mMutex.lock();
+   mStop = true;
+   mSpaceAvailable.wakeAll();
+   mMutex.unlock();
+   mpThread->wait();
+   delete mpThread;
+   mpThread = NULL;
+}
+
+bool RowReader::isValid()
+{
+   if (mRow > mEndRow)
+   {
+      return false;
+   }
+   if (mDepth == 0)
+   {
+      return mpAccessor->isValid();
+   }
+   if (mpThread == NULL)
+   {
+      startReading();
+   }
+
+   if (!mHaveChunk)
+   {
+      QMutexLocker lock(&mMutex);
+      while (mReadyCount == 0 && !mFailed)
+      {
+         mDataAvailable.wait(&mMutex);
+      }
+      if (mReadyCount == 0)
+      {
+         return false;
+      }
+      mHaveChunk = true;
+      mRowInChunk = 0;
+   }
+   return true;
+}
+
+void* RowReader::getRow()
+{
+   if (mDepth == 0)
+   {
+      return (*mpAccessor)->getRow();
+   }
+   if (!isValid())
+   {
+      return NULL;
+   }
+   return &mChunks[mReadIndex][static_cast<size_t>(mRowInChunk) * mRowBytes];
+}
+
+void RowReader::nextRow()
+{
+   if (mDepth == 0)
+   {
+      (*mpAccessor)->nextRow();
+      ++mRow;
+      return;
+   }
+   if (!isValid())
+   {
+      return;
+   }
+
+   ++mRow;
+   if (++mRowInChunk == mChunkRowCounts[mReadIndex])
+   {
+      //hand the buffer back to the reader
+      QMutexLocker lock(&mMutex);
+      mReadIndex = (mReadIndex + 1) % mChunks.size();
+      --mReadyCount;
+      mHaveChunk = false;
+      mSpaceAvailable.wakeOne();
+   }
+   if (mRow > mEndRow)
+   {
+      //every row has been read, so the buffers are freed until a restart
+      stopReading();
+      std::vector<std::vector<char> >().swap(mChunks);
+   }
+}
+
+void RowReader::restart()
+{
+   //goes back to the first row through the same accessor, the read ahead starting again with the next read
+   stopReading();
+   (*mpAccessor)->toPixel(mStartRow, mStartColumn);
+   mRow = mStartRow;
+   mReadyCount = 0;
+   mFailed = false;
+   mStop = false;
+   mReadIndex = 0;
+   mRowInChunk = 0;
+   mHaveChunk = false;
+}
+
+void RowReader::addReadAheadArgs(PlugInArgList* pArgList)
+{
+   pArgList->addArg<unsigned int>("Read Ahead Rows", sDefaultRowsPerChunk,
+      "Rows read per chunk when reading ahead of the calculation");
+   pArgList->addArg<unsigned int>("Read Ahead Depth", sDefaultDepth,
+      "Chunks read ahead of the calculation for cubes on disk, 0 to read directly");
+}
+
+void RowReader::getReadAheadArgs(PlugInArgList* pArgList, unsigned int& rowsPerChunk, unsigned int& depth)
+{
+   rowsPerChunk = sDefaultRowsPerChunk;
+   depth = sDefaultDepth;
+   pArgList->getPlugInArgValue("Read Ahead Rows", rowsPerChunk);
+   pArgList->getPlugInArgValue("Read Ahead Depth", depth);
+}
+
+void RowReader::readAhead()
+{
+   unsigned int writeIndex = 0;
+   for (unsigned int row = mStartRow; row <= mEndRow; )
+   {
+      {
+         QMutexLocker lock(&mMutex);
+         while (mReadyCount == mChunks.size() && !mStop)
+         {
+            mSpaceAvailable.wait(&mMutex);
+         }
+         if (mStop)
+         {
+            return;
+         }
+      }
+
+      //the buffer at writeIndex is not visible to the consumer until mReadyCount says so
+      unsigned int rowCount = std::min(mRowsPerChunk, mEndRow - row + 1);
+      char* pChunk = &mChunks[writeIndex][0];
+      for (unsigned int chunkRow = 0; chunkRow < rowCount; ++chunkRow)
+      {
+         const void* pRow = mpAccessor->isValid() ? (*mpAccessor)->getRow() : NULL;
+         if (pRow == NULL)
+         {
+            QMutexLocker lock(&mMutex);
+            mFailed = true;
+            mDataAvailable.wakeAll();
+            return;
+         }
+         memcpy(pChunk + static_cast<size_t>(chunkRow) * mRowBytes, pRow, mRowBytes);
+         (*mpAccessor)->nextRow();
+      }
+
+      QMutexLocker lock(&mMutex);
+      mChunkRowCounts[writeIndex] = rowCount;
+      writeIndex = (writeIndex + 1) % mChunks.size();
+      ++mReadyCount;
+      mDataAvailable.wakeOne();
+      row += rowCount;
+   }
+}
+
+BandRowReaders::BandRowReaders(RasterElement* pCube, const std::vector<unsigned int>& bands, unsigned int startRow,
+                               unsigned int endRow, unsigned int rowsPerChunk, unsigned int depth) :
+   mRows(bands.size(), NULL)
+{
+   const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(pCube->getDataDescriptor());
+   for (std::vector<unsigned int>::const_iterator it = bands.begin(); it != bands.end(); ++it)
+   {
+      mReaders.push_back(new RowReader(pCube, startRow, endRow, 0, pDesc->getColumnCount() - 1, rowsPerChunk, depth,
+         *it));
+   }
+}
+
+BandRowReaders::BandRowReaders(RasterElement* pCube, InterleaveFormatType interleave, unsigned int startRow,
+                               unsigned int endRow, unsigned int rowsPerChunk, unsigned int depth) :
+   mRows(1, NULL)
+{
+   mReaders.push_back(new RowReader(pCube, startRow, endRow, interleave, rowsPerChunk, depth));
+}
+
+BandRowReaders::~BandRowReaders()
+{
+   for (std::vector<RowReader*>::iterator it = mReaders.begin(); it != mReaders.end(); ++it)
+   {
+      delete *it;
+   }
+}
+
+bool BandRowReaders::isValid()
+{
+   for (std::vector<RowReader*>::iterator it = mReaders.begin(); it != mReaders.end(); ++it)
+   {
+      if (!(*it)->isValid())
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+const std::vector<void*>& BandRowReaders::getRows()
+{
+   for (unsigned int band = 0; band < mReaders.size(); ++band)
+   {
+      mRows[band] = mReaders[band]->getRow();
+   }
+   return mRows;
+}
+
+void BandRowReaders::nextRow()
+{
+   for (std::vector<RowReader*>::iterator it = mReaders.begin(); it != mReaders.end(); ++it)
+   {
+      (*it)->nextRow();
+   }
+}
+
+void BandRowReaders::restart()
+{
+   for (std::vector<RowReader*>::iterator it = mReaders.begin(); it != mReaders.end(); ++it)
+   {
+      (*it)->restart();
+   }
+}
@@ -0,0 +1,116 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef ROWREADER_H
+#define ROWREADER_H
+
+#include "TypesFile.h"
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <vector>
+
+class DataAccessor;
+class DataRequest;
+class PlugInArgList;
+class RasterElement;
+
+/**
+ * Reads a rectangle of one band (the first by default) of a raster element one row at a time, like a BSQ
+ * DataAccessor, or full rows of every band in BIP or BIL order.
+ *
+ * With a read ahead depth, a background thread copies chunks of rows into a ring of that many buffers
+ * while the caller works on the current one, so disk reads overlap the processing. Cubes which are
+ * already in memory are always read directly.
+ *
+ * The accessor is requested when the reader is created, so it is created on the thread which owns the
+ * cube and can then be read on any other. The read ahead thread only starts with the first read, and
+ * restart() goes back to the first row for another pass.
+ */
+class RowReader
+{
+public:
+   RowReader(RasterElement* pCube, unsigned int startRow, unsigned int endRow, unsigned int startColumn,
+      unsigned int endColumn, unsigned int rowsPerChunk = 0, unsigned int depth = 0, unsigned int band = 0);
+   RowReader(RasterElement* pCube, unsigned int startRow, unsigned int endRow, InterleaveFormatType interleave,
+      unsigned int rowsPerChunk = 0, unsigned int depth = 0);
+   ~RowReader();
+
+   bool isValid();
+   void* getRow();
+   void nextRow();
+   void restart();
+
+   //the Read Ahead Rows and Read Ahead Depth args of the plug-ins which read through RowReaders
+   static void addReadAheadArgs(PlugInArgList* pArgList);
+   static void getReadAheadArgs(PlugInArgList* pArgList, unsigned int& rowsPerChunk, unsigned int& depth);
+
+private:
+   RowReader(const RowReader& rhs);
+   RowReader& operator=(const RowReader& rhs);
+
+   class ReaderThread;
+   void start(RasterElement* pCube, DataRequest* pRequest, unsigned int depth);
+   void startReading();
+   void stopReading();
+   void readAhead();
+
+   DataAccessor* mpAccessor;
+   unsigned int mStartRow;
+   unsigned int mStartColumn;
+   unsigned int mRow;
+   unsigned int mEndRow;
+   unsigned int mRowBytes;
+   unsigned int mRowsPerChunk;
+   unsigned int mDepth;
+
+   // read ahead state, guarded by mMutex
+   std::vector<std::vector<char> > mChunks;
+   std::vector<unsigned int> mChunkRowCounts;
+   unsigned int mReadyCount;
+   bool mFailed;
+   bool mStop;
+   QMutex mMutex;
+   QWaitCondition mDataAvailable;
+   QWaitCondition mSpaceAvailable;
+
+   // only touched by the consuming thread
+   unsigned int mReadIndex;
+   unsigned int mRowInChunk;
+   bool mHaveChunk;
+
+   ReaderThread* mpThread;
+};
+
+/**
+ * Full width rows of several bands of a raster element, read by one RowReader each and stepped together,
+ * or full rows of every band in BIP or BIL order read by a single RowReader.
+ */
+class BandRowReaders
+{
+public:
+   BandRowReaders(RasterElement* pCube, const std::vector<unsigned int>& bands, unsigned int startRow,
+      unsigned int endRow, unsigned int rowsPerChunk = 0, unsigned int depth = 0);
+   BandRowReaders(RasterElement* pCube, InterleaveFormatType interleave, unsigned int startRow, unsigned int endRow,
+      unsigned int rowsPerChunk = 0, unsigned int depth = 0);
+   ~BandRowReaders();
+
+   bool isValid();
+   const std::vector<void*>& getRows();
+   void nextRow();
+   void restart();
+
+private:
+   BandRowReaders(const BandRowReaders& rhs);
+   BandRowReaders& operator=(const BandRowReaders& rhs);
+
+   std::vector<RowReader*> mReaders;
+   std::vector<void*> mRows;
+};
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "BandMath.h"
+#include "Progress.h"
+#include "RasterDataDescriptor.h"
+#include "RasterElement.h"
+#include "RowReader.h"
+#include "RowStripWorker.h"
+#include <QtCore/QThread>
+#include <algorithm>
+
+class RowStripThreadGroup::WorkerThread : public QThread
+{
+public:
+   WorkerThread(RowStripWorker* pWorker) : mpWorker(pWorker)
+   {
+   }
+
+protected:
+   virtual void run()
+   {
+      mpWorker->run();
+   }
+
+private:
+   RowStripWorker* mpWorker;
+};
+
+RowStripReaders::RowStripReaders(RasterElement* pCube, const std::vector<unsigned int>& strips,
+                                 const std::vector<unsigned int>& bands, unsigned int rowsPerChunk, unsigned int depth) :
+   mStrips(strips)
+{
+   for (unsigned int strip = 0; strip + 1 < mStrips.size(); ++strip)
+   {
+      mReaders.push_back(new BandRowReaders(pCube, bands, getStartRow(strip), getEndRow(strip), rowsPerChunk, depth));
+   }
+}
+
+RowStripReaders::RowStripReaders(RasterElement* pCube, const std::vector<unsigned int>& strips,
+                                 InterleaveFormatType interleave, unsigned int rowsPerChunk, unsigned int depth) :
+   mStrips(strips)
+{
+   for (unsigned int strip = 0; strip + 1 < mStrips.size(); ++strip)
+   {
+      mReaders.push_back(new BandRowReaders(pCube, interleave, getStartRow(strip), getEndRow(strip), rowsPerChunk,
+         depth));
+   }
+}
+
+RowStripReaders::~RowStripReaders()
+{
+   for (std::vector<BandRowReaders*>::iterator it = mReaders.begin(); it != mReaders.end(); ++it)
+   {
+      delete *it;
+   }
+}
+
+unsigned int RowStripReaders::getStripCount() const
+{
+   return mReaders.size();
+}
+
+unsigned int RowStripReaders::getStartRow(unsigned int strip) const
+{
+   return mStrips[strip];
+}
+
+unsigned int RowStripReaders::getEndRow(unsigned int strip) const
+{
+   return mStrips[strip + 1] - 1;
+}
+
+BandRowReaders& RowStripReaders::getReaders(unsigned int strip)
+{
+   return *mReaders[strip];
+}
+
+RowStripWorker::RowStripWorker(RasterElement* pCube, RowStripReaders& readers, unsigned int strip,
+                               QAtomicInt& rowsDone, QAtomicInt& aborted) :
+   mpDescriptor(static_cast<const RasterDataDescriptor*>(pCube->getDataDescriptor())),
+   mReaders(readers.getReaders(strip)),
+   mStartRow(readers.getStartRow(strip)),
+   mEndRow(readers.getEndRow(strip)),
+   mRowsDone(rowsDone),
+   mAborted(aborted),
+   mpExpression(NULL),
+   mpBandMask(NULL),
+   mSuccess(false)
+{
+}
+
+RowStripWorker::~RowStripWorker()
+{
+}
+
+void RowStripWorker::run()
+{
+   mSuccess = false;
+   if (mpDescriptor == NULL || mStartRow > mEndRow)
+   {
+      return;
+   }
+
+   //the readers may have been read to the end by the worker of an earlier pass
+   mReaders.restart();
+   BandMathExpression::Rows expressionRows;
+   for (unsigned int row = mStartRow; row <= mEndRow; ++row)
+   {
+      if (mAborted != 0 || !mReaders.isValid())
+      {
+         return;
+      }
+
+      if (mpExpression == NULL)
+      {
+         processRow(mReaders.getRows().front(), row);
+      }
+      else
+      {
+         const double* pValues = mpExpression->evaluate(mpDescriptor->getDataType(), mReaders.getRows(),
+            mpDescriptor->getColumnCount(), *mpBandMask, expressionRows);
+         processRow(const_cast<double*>(pValues), row);
+      }
+      mReaders.nextRow();
+      mRowsDone.fetchAndAddRelaxed(1);
+   }
+   mSuccess = true;
+}
+
+void RowStripWorker::setExpression(const BandMathExpression* pExpression, const BadValueMask* pBandMask)
+{
+   //pBandMask marks the bad samples of the bands read, the expression is NaN wherever one is used; the strip's
+   //readers must read the bands the expression uses
+   mpExpression = pExpression;
+   mpBandMask = pBandMask;
+}
+
+bool RowStripWorker::isSuccessful() const
+{
+   return mSuccess;
+}
+
+std::vector<unsigned int> RowStripWorker::splitRows(unsigned int rowCount, unsigned int stripCount)
+{
+   // returns stripCount + 1 boundaries, strip i covers [bounds[i], bounds[i + 1])
+   std::vector<unsigned int> bounds(stripCount + 1, 0);
+   for (unsigned int strip = 1; strip <= stripCount; ++strip)
+   {
+      bounds[strip] = static_cast<unsigned int>(static_cast<unsigned long long>(rowCount) * strip / stripCount);
+   }
+   return bounds;
+}
+
+unsigned int RowStripWorker::getThreadCount(unsigned int rowCount, unsigned int threadCount)
+{
+   // 0 asks for one thread per processor
+   if (threadCount == 0)
+   {
+      threadCount = static_cast<unsigned int>(std::max(QThread::idealThreadCount(), 1));
+   }
+   return std::max(1u, std::min(threadCount, rowCount));
+}
+
+const RasterDataDescriptor* RowStripWorker::getDescriptor() const
+{
+   return mpDescriptor;
+}
+
+EncodingType RowStripWorker::getDataType() const
+{
+   return (mpExpression != NULL) ? FLT8BYTES : mpDescriptor->getDataType();
+}
+
+unsigned int RowStripWorker::getColumnCount() const
+{
+   return mpDescriptor->getColumnCount();
+}
+
+RowStripThreadGroup::RowStripThreadGroup()
+{
+}
+
+RowStripThreadGroup::~RowStripThreadGroup()
+{
+   for (std::vector<WorkerThread*>::iterator it = mThreads.begin(); it != mThreads.end(); ++it)
+   {
+      (*it)->wait();
+      delete *it;
+   }
+   for (std::vector<RowStripWorker*>::iterator it = mWorkers.begin(); it != mWorkers.end(); ++it)
+   {
+      delete *it;
+   }
+}
+
+void RowStripThreadGroup::addWorker(RowStripWorker* pWorker)
+{
+   if (pWorker != NULL)
+   {
+      mWorkers.push_back(pWorker);
+   }
+}
+
+RowStripWorker* RowStripThreadGroup::getWorker(unsigned int index) const
+{
+   return index < mWorkers.size() ? mWorkers[index] : NULL;
+}
+
+unsigned int RowStripThreadGroup::getWorkerCount() const
+{
+   return mWorkers.size();
+}
+
+void RowStripThreadGroup::start()
+{
+   for (std::vector<RowStripWorker*>::iterator it = mWorkers.begin(); it != mWorkers.end(); ++it)
+   {
+      WorkerThread* pThread = new WorkerThread(*it);
+      mThreads.push_back(pThread);
+      pThread->start();
+   }
+}
+
+bool RowStripThreadGroup::wait(unsigned long milliseconds)
+{
+   // returns true once every worker has finished
+   for (std::vector<WorkerThread*>::iterator it = mThreads.begin(); it != mThreads.end(); ++it)
+   {
+      if (!(*it)->wait(milliseconds))
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+bool RowStripThreadGroup::isSuccessful() const
+{
+   for (std::vector<RowStripWorker*>::const_iterator it = mWorkers.begin(); it != mWorkers.end(); ++it)
+   {
+      if (!(*it)->isSuccessful())
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+bool RowStripThreadGroup::run(QAtomicInt& rowsDone, unsigned int rowCount, QAtomicInt& aborted, Progress* pProgress,
+                              const std::string& text, int startPercent, int endPercent)
+{
+   if (pProgress == NULL && mWorkers.size() == 1)
+   {
+      mWorkers.front()->run();
+      return aborted == 0 && isSuccessful();
+   }
+
+   //Progress is only reported from the calling thread, the workers just count their rows.
+   start();
+   while (!wait(100))
+   {
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(text, startPercent + (endPercent - startPercent) * static_cast<int>(rowsDone) /
+            static_cast<int>(std::max(rowCount, 1u)), NORMAL);
+      }
+   }
+   return aborted == 0 && isSuccessful();
+}
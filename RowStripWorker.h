@@ -0,0 +1,138 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef ROWSTRIPWORKER_H
+#define ROWSTRIPWORKER_H
+
+#include "TypesFile.h"
+#include <QtCore/QAtomicInt>
+#include <string>
+#include <vector>
+
+class BadValueMask;
+class BandMathExpression;
+class BandRowReaders;
+class Progress;
+class RasterDataDescriptor;
+class RasterElement;
+
+/**
+ * The readers of a raster element split into strips of rows, one BandRowReaders
+ * per strip.
+ *
+ * They are created up front on the thread which owns the cube, so the workers
+ * only read through them from whichever thread they run on. Each worker restarts
+ * its strip's readers, so the same readers serve every pass over the strips.
+ */
+class RowStripReaders
+{
+public:
+   RowStripReaders(RasterElement* pCube, const std::vector<unsigned int>& strips,
+      const std::vector<unsigned int>& bands, unsigned int rowsPerChunk, unsigned int depth);
+   RowStripReaders(RasterElement* pCube, const std::vector<unsigned int>& strips,
+      InterleaveFormatType interleave, unsigned int rowsPerChunk, unsigned int depth);
+   ~RowStripReaders();
+
+   unsigned int getStripCount() const;
+   unsigned int getStartRow(unsigned int strip) const;
+   unsigned int getEndRow(unsigned int strip) const;
+   BandRowReaders& getReaders(unsigned int strip);
+
+private:
+   RowStripReaders(const RowStripReaders& rhs);
+   RowStripReaders& operator=(const RowStripReaders& rhs);
+
+   std::vector<unsigned int> mStrips;
+   std::vector<BandRowReaders*> mReaders;
+};
+
+/**
+ * Processes one strip of rows of a raster element, read through the strip's
+ * readers: the first band, the bands a band math expression uses, or the full
+ * rows of every band, depending on how the RowStripReaders were created.
+ *
+ * Several workers can run on separate threads over the disjoint strips of the
+ * same cube. Subclasses keep their own partial results, which the caller merges
+ * once all workers are done.
+ *
+ * With a band math expression, each row handed to processRow() is instead the
+ * expression evaluated over the bands it uses, as doubles (see getDataType()).
+ */
+class RowStripWorker
+{
+public:
+   RowStripWorker(RasterElement* pCube, RowStripReaders& readers, unsigned int strip,
+      QAtomicInt& rowsDone, QAtomicInt& aborted);
+   virtual ~RowStripWorker();
+
+   void setExpression(const BandMathExpression* pExpression, const BadValueMask* pBandMask);
+   void run();
+   bool isSuccessful() const;
+
+   static std::vector<unsigned int> splitRows(unsigned int rowCount, unsigned int stripCount);
+   static unsigned int getThreadCount(unsigned int rowCount, unsigned int threadCount);
+
+protected:
+   virtual void processRow(void* pRow, unsigned int row) = 0;
+
+   const RasterDataDescriptor* getDescriptor() const;
+   EncodingType getDataType() const;
+   unsigned int getColumnCount() const;
+
+private:
+   const RasterDataDescriptor* mpDescriptor;
+   BandRowReaders& mReaders;
+   unsigned int mStartRow;
+   unsigned int mEndRow;
+   QAtomicInt& mRowsDone;
+   QAtomicInt& mAborted;
+   const BandMathExpression* mpExpression;
+   const BadValueMask* mpBandMask;
+   bool mSuccess;
+};
+
+/**
+ * Runs a set of RowStripWorkers, one thread each, and owns them until destroyed.
+ */
+class RowStripThreadGroup
+{
+public:
+   RowStripThreadGroup();
+   ~RowStripThreadGroup();
+
+   void addWorker(RowStripWorker* pWorker);
+   RowStripWorker* getWorker(unsigned int index) const;
+   unsigned int getWorkerCount() const;
+
+   void start();
+   bool wait(unsigned long milliseconds);
+   bool isSuccessful() const;
+
+   /**
+    * Starts the workers and waits for them to finish. Meanwhile the progress is
+    * updated every 100 ms with rowsDone out of rowCount, as a percentage from
+    * startPercent to endPercent. Abort requests reach the workers only through
+    * aborted, which the plug-in sets when it is aborted. A single worker with no
+    * progress to report is run on the calling thread instead.
+    *
+    * @return True if no abort was requested and every worker succeeded.
+    */
+   bool run(QAtomicInt& rowsDone, unsigned int rowCount, QAtomicInt& aborted, Progress* pProgress,
+      const std::string& text, int startPercent, int endPercent);
+
+private:
+   RowStripThreadGroup(const RowStripThreadGroup& rhs);
+   RowStripThreadGroup& operator=(const RowStripThreadGroup& rhs);
+
+   class WorkerThread;
+   std::vector<RowStripWorker*> mWorkers;
+   std::vector<WorkerThread*> mThreads;
+};
+
+#endif
@@ -0,0 +1,316 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "DataAccessor.h"
+#include "DataAccessorImpl.h"
+#include "DataRequest.h"
+#include "ModelServices.h"
+#include "ObjectResource.h"
+#include "RasterElement.h"
+#include "RowWriter.h"
+#include "StringUtilities.h"
+#include "TypeConverter.h"
+#include <QtCore/QFileInfo>
+#include <algorithm>
+#include <fstream>
+
+namespace
+{
+   //rows are mapped this many bytes at a time, so a large result never needs one huge mapping
+   const unsigned int sWindowBytes = 64 * 1024 * 1024;
+
+   //ENVI data type code and element size, 0 for the types ENVI cannot describe
+   void getEnviType(EncodingType type, int& code, unsigned int& bytes)
+   {
+      code = 0;
+      bytes = 0;
+      switch (type)
+      {
+      case INT1UBYTE:
+         code = 1;
+         bytes = 1;
+         break;
+      case INT2SBYTES:
+         code = 2;
+         bytes = 2;
+         break;
+      case INT2UBYTES:
+         code = 12;
+         bytes = 2;
+         break;
+      case INT4SBYTES:
+         code = 3;
+         bytes = 4;
+         break;
+      case INT4UBYTES:
+         code = 13;
+         bytes = 4;
+         break;
+      case FLT4BYTES:
+         code = 4;
+         bytes = 4;
+         break;
+      case FLT8BYTES:
+         code = 5;
+         bytes = 8;
+         break;
+      case FLT8COMPLEX:
+         //two 4 byte floats
+         code = 6;
+         bytes = 8;
+         break;
+      default:
+         break;
+      }
+   }
+}
+
+RowWriter::RowWriter(RasterElement* pElement) :
+   mpElement(pElement),
+   mpAccessor(NULL),
+   mType(),
+   mpWindow(NULL),
+   mRowCount(0),
+   mRowBytes(0),
+   mRowsPerWindow(0),
+   mRow(0),
+   mWindowStart(0),
+   mFailed(false),
+   mFinished(false)
+{
+   restart();
+}
+
+RowWriter::RowWriter(const std::string& filename, unsigned int rowCount, unsigned int columnCount,
+                     EncodingType type) :
+   mpElement(NULL),
+   mpAccessor(NULL),
+   mType(type),
+   mpWindow(NULL),
+   mRowCount(rowCount),
+   mRowBytes(0),
+   mRowsPerWindow(0),
+   mRow(0),
+   mWindowStart(0),
+   mFailed(true),
+   mFinished(false)
+{
+   int code = 0;
+   unsigned int bytes = 0;
+   getEnviType(type, code, bytes);
+   if (code == 0 || rowCount == 0 || columnCount == 0)
+   {
+      return;
+   }
+   mRowBytes = columnCount * bytes;
+   mRowsPerWindow = std::min(rowCount, std::max(1u, sWindowBytes / mRowBytes));
+
+   //sizing the file first lets every row be written in place through the mapping
+   mFile.setFileName(QString::fromStdString(filename));
+   if (!mFile.open(QIODevice::ReadWrite | QIODevice::Truncate) ||
+      !mFile.resize(static_cast<qint64>(rowCount) * mRowBytes))
+   {
+      return;
+   }
+   mFailed = !mapWindow(0);
+}
+
+RowWriter::~RowWriter()
+{
+   if (mpWindow != NULL)
+   {
+      mFile.unmap(mpWindow);
+   }
+   if (mFile.isOpen())
+   {
+      //opened but never finished, so what is in it is not a result
+      removeFile();
+   }
+   delete mpAccessor;
+}
+
+bool RowWriter::isValid()
+{
+   if (mpElement != NULL)
+   {
+      return mpAccessor->isValid();
+   }
+   return !mFailed && mRow < mRowCount;
+}
+
+void* RowWriter::getRow()
+{
+   if (mpElement != NULL)
+   {
+      return (*mpAccessor)->getRow();
+   }
+   if (!isValid())
+   {
+      return NULL;
+   }
+   return mpWindow + static_cast<size_t>(mRow - mWindowStart) * mRowBytes;
+}
+
+void RowWriter::nextRow()
+{
+   if (mpElement != NULL)
+   {
+      (*mpAccessor)->nextRow();
+      return;
+   }
+   if (!isValid())
+   {
+      return;
+   }
+
+   ++mRow;
+   if (mRow < mRowCount && mRow == mWindowStart + mRowsPerWindow)
+   {
+      mFailed = !mapWindow(mRow);
+   }
+}
+
+void RowWriter::restart()
+{
+   //goes back to the first row, keeping what has been written
+   if (mpElement != NULL)
+   {
+      delete mpAccessor;
+      FactoryResource<DataRequest> pRequest;
+      pRequest->setWritable(true);
+      mpAccessor = new DataAccessor(mpElement->getDataAccessor(pRequest.release()));
+      return;
+   }
+   if (mFile.isOpen() && mRowBytes > 0)
+   {
+      mRow = 0;
+      mFailed = !mapWindow(0);
+   }
+}
+
+void RowWriter::toRow(unsigned int row)
+{
+   //moves to any row, keeping what has been written
+   if (mpElement != NULL)
+   {
+      (*mpAccessor)->toPixel(row, 0);
+      return;
+   }
+   if (!mFile.isOpen() || mRowBytes == 0)
+   {
+      return;
+   }
+   mRow = row;
+   if (mRow >= mRowCount)
+   {
+      return;
+   }
+   if (mpWindow == NULL || mRow < mWindowStart || mRow >= mWindowStart + mRowsPerWindow)
+   {
+      unsigned int start = mRow;
+      if (mRow < mWindowStart)
+      {
+         //moving up the rows, so the window ends at this row instead
+         start = (mRow + 1 > mRowsPerWindow) ? mRow + 1 - mRowsPerWindow : 0;
+      }
+      mFailed = !mapWindow(start);
+   }
+}
+
+bool RowWriter::finish()
+{
+   //an element is written in place, a file is complete once it is closed with its header beside it
+   if (mpElement != NULL || mFinished)
+   {
+      return true;
+   }
+   if (!mFile.isOpen())
+   {
+      return false;
+   }
+   if (mpWindow != NULL)
+   {
+      mFile.unmap(mpWindow);
+      mpWindow = NULL;
+   }
+   mFile.close();
+   mFinished = !mFailed && writeHeader(mFile.fileName().toStdString(), mType);
+   if (!mFinished)
+   {
+      removeFile();
+   }
+   return mFinished;
+}
+
+std::string RowWriter::getHeaderFilename(const std::string& filename)
+{
+   QFileInfo info(QString::fromStdString(filename));
+   return (info.path() + "/" + info.completeBaseName() + ".hdr").toStdString();
+}
+
+std::string RowWriter::getUnusedElementName(const std::string& name)
+{
+   //a new result is named after the first of name, name_2, name_3 and so on which no top level raster element
+   //has, so it never replaces an earlier result the user may still be viewing
+   Service<ModelServices> pModel;
+   std::string unusedName = name;
+   for (unsigned int number = 2;
+      pModel->getElement(unusedName, TypeConverter::toString<RasterElement>(), NULL) != NULL; ++number)
+   {
+      unusedName = name + "_" + StringUtilities::toDisplayString(number);
+   }
+   return unusedName;
+}
+
+bool RowWriter::writeHeader(const std::string& filename, EncodingType type) const
+{
+   int code = 0;
+   unsigned int bytes = 0;
+   getEnviType(type, code, bytes);
+   const unsigned short one = 1;
+   bool bigEndian = (*reinterpret_cast<const unsigned char*>(&one) == 0);
+
+   std::ofstream header(getHeaderFilename(filename).c_str());
+   header << "ENVI" << std::endl;
+   header << "description = {" << QFileInfo(QString::fromStdString(filename)).fileName().toStdString() << "}"
+      << std::endl;
+   header << "samples = " << mRowBytes / bytes << std::endl;
+   header << "lines = " << mRowCount << std::endl;
+   header << "bands = 1" << std::endl;
+   header << "header offset = 0" << std::endl;
+   header << "file type = ENVI Standard" << std::endl;
+   header << "data type = " << code << std::endl;
+   header << "interleave = bsq" << std::endl;
+   header << "byte order = " << (bigEndian ? 1 : 0) << std::endl;
+   header.close();
+   return !header.fail();
+}
+
+void RowWriter::removeFile()
+{
+   //the file was truncated when it was opened, so a header already beside it no longer describes it either
+   mFile.close();
+   std::string filename = mFile.fileName().toStdString();
+   QFile::remove(mFile.fileName());
+   QFile::remove(QString::fromStdString(getHeaderFilename(filename)));
+}
+
+bool RowWriter::mapWindow(unsigned int start)
+{
+   //maps the window of rows from start, which has to hold mRow
+   if (mpWindow != NULL)
+   {
+      mFile.unmap(mpWindow);
+      mpWindow = NULL;
+   }
+   mWindowStart = start;
+   unsigned int rowCount = std::min(mRowsPerWindow, mRowCount - start);
+   mpWindow = mFile.map(static_cast<qint64>(start) * mRowBytes, static_cast<qint64>(rowCount) * mRowBytes);
+   return mpWindow != NULL;
+}
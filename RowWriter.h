@@ -0,0 +1,68 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef ROWWRITER_H
+#define ROWWRITER_H
+
+#include "TypesFile.h"
+#include <QtCore/QFile>
+#include <string>
+
+class DataAccessor;
+class RasterElement;
+
+/**
+ * Writes a single band result one row at a time, either into a raster element or straight into a raw file.
+ *
+ * A file is sized up front and mapped into memory a window of rows at a time, so the rows are written in place
+ * without an element or an export copy. finish() closes the file and writes an ENVI header describing it next
+ * to it, once the rows are complete. A file which was not finished is removed when the writer is destroyed, so
+ * a failed or aborted run leaves no partial result behind.
+ */
+class RowWriter
+{
+public:
+   RowWriter(RasterElement* pElement);
+   RowWriter(const std::string& filename, unsigned int rowCount, unsigned int columnCount, EncodingType type);
+   ~RowWriter();
+
+   bool isValid();
+   void* getRow();
+   void nextRow();
+   void restart();
+   void toRow(unsigned int row);
+   bool finish();
+
+   static std::string getHeaderFilename(const std::string& filename);
+   static std::string getUnusedElementName(const std::string& name);
+
+private:
+   RowWriter(const RowWriter& rhs);
+   RowWriter& operator=(const RowWriter& rhs);
+
+   bool writeHeader(const std::string& filename, EncodingType type) const;
+   void removeFile();
+   bool mapWindow(unsigned int start);
+
+   RasterElement* mpElement;
+   DataAccessor* mpAccessor;
+
+   QFile mFile;
+   EncodingType mType;
+   uchar* mpWindow;
+   unsigned int mRowCount;
+   unsigned int mRowBytes;
+   unsigned int mRowsPerWindow;
+   unsigned int mRow;
+   unsigned int mWindowStart;
+   bool mFailed;
+   bool mFinished;
+};
+
+#endif
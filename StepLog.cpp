@@ -0,0 +1,298 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "StepLog.h"
+#include <QtCore/QAtomicInt>
+#include <QtCore/QAtomicPointer>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QEvent>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+
+namespace
+{
+   //finished steps are written once this many are queued, or after the interval at the latest
+   const int sBatchSize = 256;
+   const int sFlushInterval = 250;
+
+   //finished steps, the last one first
+   QAtomicPointer<DeferredStep> sQueue(NULL);
+   QAtomicInt sQueued(0);
+
+   //set by the first step queued after the writer last wrote, so only that one posts to the writer
+   QAtomicInt sPosted(0);
+
+   QAtomicInt sDeferred(0);
+
+   //the steps between their isDeferred() check and posting to the writer, which setDeferred(false) waits for before
+   //it removes the writer and writes the last of the queue
+   QAtomicInt sQueueing(0);
+   QAtomicInt sVerbosity(StepLog::ALL);
+   QAtomicInt sWritten(0);
+   QAtomicInt sDropped(0);
+
+   //only one thread writes to the message log at a time
+   QMutex sWriteMutex;
+
+   const QEvent::Type sStepsQueued = static_cast<QEvent::Type>(QEvent::registerEventType());
+
+   //writes the queued steps to the message log on the main thread, which created it; the threads finishing
+   //steps only post it an event, so it is not given a slot and needs no moc
+   class StepWriter : public QObject
+   {
+   public:
+      StepWriter() : mTimer(0)
+      {
+      }
+
+   protected:
+      virtual void customEvent(QEvent* pEvent)
+      {
+         if (pEvent->type() != sStepsQueued)
+         {
+            return;
+         }
+         if (sQueued >= sBatchSize)
+         {
+            write();
+         }
+         else if (mTimer == 0)
+         {
+            mTimer = startTimer(sFlushInterval);
+         }
+      }
+
+      virtual void timerEvent(QTimerEvent*)
+      {
+         write();
+      }
+
+   private:
+      void write()
+      {
+         if (mTimer != 0)
+         {
+            killTimer(mTimer);
+            mTimer = 0;
+         }
+
+         //cleared first, so a step queued while the others are written posts again
+         sPosted = 0;
+         StepLog::flush();
+      }
+
+      int mTimer;
+   };
+
+   //only created and destroyed by StepLog::setDeferred() on the main thread
+   QAtomicPointer<StepWriter> sWriter(NULL);
+}
+
+void StepLog::setDeferred(bool deferred)
+{
+   if (deferred)
+   {
+      if (sWriter == NULL)
+      {
+         sWriter.fetchAndStoreOrdered(new StepWriter);
+      }
+      sDeferred = 1;
+   }
+   else
+   {
+      sDeferred.fetchAndStoreOrdered(0);
+      while (sQueueing != 0)
+      {
+         QThread::yieldCurrentThread();
+      }
+      delete sWriter.fetchAndStoreOrdered(NULL);
+      sPosted = 0;
+      flush();
+   }
+}
+
+bool StepLog::isDeferred()
+{
+   return sDeferred != 0;
+}
+
+void StepLog::setVerbosity(Verbosity verbosity)
+{
+   sVerbosity = verbosity;
+}
+
+StepLog::Verbosity StepLog::getVerbosity()
+{
+   return static_cast<Verbosity>(static_cast<int>(sVerbosity));
+}
+
+void StepLog::flush()
+{
+   QMutexLocker lock(&sWriteMutex);
+   DeferredStep* pSteps = sQueue.fetchAndStoreAcquire(NULL);
+
+   //the queue is last in first out, so turn it around to write the steps in the order they finished
+   DeferredStep* pOrdered = NULL;
+   int count = 0;
+   while (pSteps != NULL)
+   {
+      DeferredStep* pNext = pSteps->mpNext;
+      pSteps->mpNext = pOrdered;
+      pOrdered = pSteps;
+      pSteps = pNext;
+      ++count;
+   }
+   sQueued.fetchAndAddRelaxed(-count);
+
+   while (pOrdered != NULL)
+   {
+      DeferredStep* pNext = pOrdered->mpNext;
+      pOrdered->write();
+      delete pOrdered;
+      pOrdered = pNext;
+   }
+   sWritten.fetchAndAddRelaxed(count);
+}
+
+unsigned int StepLog::getWrittenCount()
+{
+   return static_cast<unsigned int>(static_cast<int>(sWritten));
+}
+
+unsigned int StepLog::getDroppedCount()
+{
+   return static_cast<unsigned int>(static_cast<int>(sDropped));
+}
+
+void StepLog::finish(DeferredStep* pStep)
+{
+   if (pStep->mpResource != NULL)
+   {
+      sWritten.fetchAndAddRelaxed(1);
+      delete pStep;
+   }
+   else if (getVerbosity() == FAILURES && pStep->mResult == Message::Success)
+   {
+      sDropped.fetchAndAddRelaxed(1);
+      delete pStep;
+   }
+   else
+   {
+      sQueueing.ref();
+      bool deferred = isDeferred();
+      bool writeBatch = false;
+      if (deferred)
+      {
+         DeferredStep* pHead = NULL;
+         do
+         {
+            pHead = sQueue;
+            pStep->mpNext = pHead;
+         }
+         while (!sQueue.testAndSetRelease(pHead, pStep));
+         int queued = sQueued.fetchAndAddRelaxed(1) + 1;
+         StepWriter* pWriter = sWriter;
+         if (pWriter != NULL && (sPosted.testAndSetOrdered(0, 1) || queued == sBatchSize))
+         {
+            QCoreApplication::postEvent(pWriter, new QEvent(sStepsQueued));
+         }
+
+         //a wizard running on the main thread may not return to the event loop until it is done, so full batches
+         //of its steps are written here
+         writeBatch = pWriter != NULL && queued >= sBatchSize && QThread::currentThread() == pWriter->thread();
+      }
+      sQueueing.deref();
+
+      if (writeBatch)
+      {
+         flush();
+      }
+      else if (!deferred)
+      {
+         QMutexLocker lock(&sWriteMutex);
+         pStep->write();
+         sWritten.fetchAndAddRelaxed(1);
+         delete pStep;
+      }
+   }
+}
+
+DeferredStep::DeferredStep(const std::string& description, const std::string& component, const std::string& key) :
+   mpResource(NULL),
+   mDescription(description),
+   mComponent(component),
+   mKey(key),
+   mResult(Message::Unresolved),
+   mFinalized(false),
+   mpNext(NULL)
+{
+   //only steps which may be dropped or written later are recorded
+   if (!StepLog::isDeferred() && StepLog::getVerbosity() == StepLog::ALL)
+   {
+      mpResource = new StepResource(description, component, key);
+   }
+}
+
+DeferredStep::~DeferredStep()
+{
+   delete mpResource;
+   for (std::vector<StepProperty*>::iterator it = mProperties.begin(); it != mProperties.end(); ++it)
+   {
+      delete *it;
+   }
+}
+
+void DeferredStep::finalize(Message::Result result, const std::string& failureReason)
+{
+   if (mFinalized)
+   {
+      return;
+   }
+   mFinalized = true;
+   mResult = result;
+   mFailureReason = failureReason;
+   if (mpResource != NULL)
+   {
+      (*mpResource)->finalize(result, failureReason);
+   }
+}
+
+void DeferredStep::write()
+{
+   StepResource pStep(mDescription, mComponent, mKey);
+   for (std::vector<StepProperty*>::const_iterator it = mProperties.begin(); it != mProperties.end(); ++it)
+   {
+      (*it)->add(pStep.get());
+   }
+   pStep->finalize(mResult, mFailureReason);
+}
+
+DeferredStepResource::DeferredStepResource(const std::string& description, const std::string& component,
+                                           const std::string& key) :
+   mpStep(new DeferredStep(description, component, key))
+{
+}
+
+DeferredStepResource::~DeferredStepResource()
+{
+   mpStep->finalize(Message::Failure);
+   StepLog::finish(mpStep);
+}
+
+DeferredStep* DeferredStepResource::operator->()
+{
+   return mpStep;
+}
+
+DeferredStep* DeferredStepResource::get()
+{
+   return mpStep;
+}
@@ -0,0 +1,156 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef STEPLOG_H
+#define STEPLOG_H
+
+#include "MessageLogResource.h"
+#include <string>
+#include <vector>
+
+class DeferredStep;
+
+/**
+ * How the tutorials write their steps to the message log, for the rest of the session.
+ *
+ * Steps are written straight away by default. Deferred, they are recorded in memory and, once finalized, pushed
+ * onto a lock-free queue which is written to the message log in batches from the main thread's event loop, so
+ * plug-ins run thousands of times from a wizard do not wait on the log. With the FAILURES verbosity, steps which
+ * succeed are dropped and only failed or aborted ones are written.
+ *
+ * setDeferred() and flush() are only called on the main thread. Turning deferral off waits for steps other
+ * threads are queueing, then stops the batches and writes the steps still queued. Steps finished on the main
+ * thread are written as soon as a batch is full, as a wizard running there may not return to the event loop.
+ *
+ * Steps which are recorded rather than written straight away are written as a flat list in the order they
+ * finish, without the nesting of steps opened inside one another.
+ */
+class StepLog
+{
+public:
+   enum Verbosity
+   {
+      ALL,
+      FAILURES
+   };
+
+   static void setDeferred(bool deferred);
+   static bool isDeferred();
+   static void setVerbosity(Verbosity verbosity);
+   static Verbosity getVerbosity();
+
+   //writes every deferred step finalized so far before returning
+   static void flush();
+
+   static unsigned int getWrittenCount();
+   static unsigned int getDroppedCount();
+
+private:
+   friend class DeferredStepResource;
+
+   StepLog();
+   static void finish(DeferredStep* pStep);
+};
+
+/**
+ * One property of a recorded step, added to the real step once it is written.
+ */
+class StepProperty
+{
+public:
+   virtual ~StepProperty()
+   {
+   }
+
+   virtual void add(Step* pStep) const = 0;
+};
+
+template<typename T>
+class TypedStepProperty : public StepProperty
+{
+public:
+   TypedStepProperty(const std::string& name, const T& value) :
+      mName(name),
+      mValue(value)
+   {
+   }
+
+   virtual void add(Step* pStep) const
+   {
+      pStep->addProperty(mName, mValue);
+   }
+
+private:
+   std::string mName;
+   T mValue;
+};
+
+/**
+ * A step as the tutorials use it, either a StepResource of its own or a record of one to write later,
+ * depending on the StepLog settings when it is created.
+ */
+class DeferredStep
+{
+public:
+   template<typename T>
+   bool addProperty(const std::string& name, const T& value)
+   {
+      if (mpResource != NULL)
+      {
+         return (*mpResource)->addProperty(name, value);
+      }
+      mProperties.push_back(new TypedStepProperty<T>(name, value));
+      return true;
+   }
+
+   void finalize(Message::Result result = Message::Success, const std::string& failureReason = std::string());
+
+private:
+   friend class DeferredStepResource;
+   friend class StepLog;
+
+   DeferredStep(const std::string& description, const std::string& component, const std::string& key);
+   ~DeferredStep();
+   DeferredStep(const DeferredStep& rhs);
+   DeferredStep& operator=(const DeferredStep& rhs);
+
+   void write();
+
+   StepResource* mpResource;
+   std::string mDescription;
+   std::string mComponent;
+   std::string mKey;
+   std::vector<StepProperty*> mProperties;
+   Message::Result mResult;
+   std::string mFailureReason;
+   bool mFinalized;
+   DeferredStep* mpNext;
+};
+
+/**
+ * Used in place of a StepResource, with the same pStep->addProperty() and pStep->finalize() calls.
+ * A step which is not finalized is finalized as a failure when the resource goes away.
+ */
+class DeferredStepResource
+{
+public:
+   DeferredStepResource(const std::string& description, const std::string& component, const std::string& key);
+   ~DeferredStepResource();
+
+   DeferredStep* operator->();
+   DeferredStep* get();
+
+private:
+   DeferredStepResource(const DeferredStepResource& rhs);
+   DeferredStepResource& operator=(const DeferredStepResource& rhs);
+
+   DeferredStep* mpStep;
+};
+
+#endif
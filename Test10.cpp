@@ -0,0 +1,506 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "AppVerify.h"
+#include "BadValueMask.h"
+#include "DesktopServices.h"
+#include "MessageLogResource.h"
+#include "ObjectResource.h"
+#include "PlugInArgList.h"
+#include "PlugInManagerServices.h"
+#include "PlugInRegistration.h"
+#include "Progress.h"
+#include "RasterDataDescriptor.h"
+#include "RasterElement.h"
+#include "RasterUtilities.h"
+#include "RowReader.h"
+#include "RowWriter.h"
+#include "SpatialDataView.h"
+#include "SpatialDataWindow.h"
+#include "StepLog.h"
+#include "StringUtilities.h"
+#include "switchOnEncoding.h"
+#include "Test10.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+
+REGISTER_PLUGIN_BASIC(OpticksTutorial, Tutorial10);
+
+namespace
+{
+   enum Statistic
+   {
+      MEAN,
+      STANDARD_DEVIATION,
+      CONTRAST
+   };
+
+   //One source row as doubles less the shift, with bad samples as 0 and marked in mValid.
+   struct ShiftedRow
+   {
+      std::vector<double> mValues;
+      std::vector<unsigned char> mValid;
+   };
+
+   template<typename T>
+   void readRow(T* pData, unsigned int colSize, const BadValueMask& mask, double shift, ShiftedRow& row)
+   {
+      row.mValues.resize(colSize);
+      row.mValid.resize(colSize);
+      for (unsigned int col = 0; col < colSize; ++col)
+      {
+         double value = static_cast<double>(pData[col]);
+         bool valid = mask.isValid(value);
+         row.mValues[col] = valid ? value - shift : 0.0;
+         row.mValid[col] = valid;
+      }
+   }
+
+   template<typename T>
+   void findShift(T* pData, unsigned int colSize, const BadValueMask& mask, double& shift)
+   {
+      for (unsigned int col = 0; col < colSize; ++col)
+      {
+         double value = static_cast<double>(pData[col]);
+         if (mask.isValid(value))
+         {
+            shift = value;
+            return;
+         }
+      }
+   }
+
+   template<typename T>
+   void writeValues(T* pData, const double* pValues, unsigned int columnCount)
+   {
+      for (unsigned int col = 0; col < columnCount; ++col)
+      {
+         pData[col] = static_cast<T>(pValues[col]);
+      }
+   }
+
+   //Sums over a square window of successive rows, clipped to the image, in constant time per pixel whatever the
+   //window size. The last 2 * radius + 1 source rows are kept in a ring with running sums down each column: the row
+   //entering the window is added and the row leaving it subtracted. Each output row then slides the same way along
+   //its column sums. The running sums are rebuilt from the ring every window's worth of rows, and along a row every
+   //window's worth of columns, so rounding never builds up over the image.
+   //
+   //Values are shifted by the first valid sample of the first row, which keeps the sum of squares from losing the
+   //local variation to a large offset.
+   class LocalSums
+   {
+   public:
+      LocalSums(RowReader& reader, EncodingType type, unsigned int colSize, unsigned int rowCount,
+         const BadValueMask& mask, unsigned int radius) :
+         mReader(reader),
+         mType(type),
+         mColSize(colSize),
+         mRowCount(rowCount),
+         mMask(mask),
+         mRadius(radius),
+         mShift(0.0),
+         mRows(std::min(2 * radius + 1, rowCount)),
+         mColumnSums(colSize, 0.0),
+         mColumnSquares(colSize, 0.0),
+         mColumnCounts(colSize, 0),
+         mNextSourceRow(0),
+         mNextRow(0)
+      {
+      }
+
+      //Local statistic of the next row. Bad centers and windows without a valid sample give NaN, as do contrasts
+      //where the local mean is 0. A mean within the rounding of the shifted sums counts as 0, so it gives NaN rather
+      //than a huge contrast or an infinity.
+      bool read(Statistic statistic, std::vector<double>& result)
+      {
+         unsigned int row = mNextRow++;
+         if (row > mRadius)
+         {
+            addRow(row - mRadius - 1, -1.0);
+         }
+         for (; mNextSourceRow <= std::min(row + mRadius, mRowCount - 1); ++mNextSourceRow)
+         {
+            if (!readSource(mNextSourceRow))
+            {
+               return false;
+            }
+            addRow(mNextSourceRow, 1.0);
+         }
+         if (row % mRows.size() == 0)
+         {
+            rebuildColumns(row);
+         }
+
+         const ShiftedRow& center = mRows[row % mRows.size()];
+         result.resize(mColSize);
+         double sum = 0.0;
+         double squares = 0.0;
+         unsigned int count = 0;
+         for (unsigned int col = 0; col < mColSize; ++col)
+         {
+            if (col % (2 * mRadius + 1) == 0)
+            {
+               //rebuild the window sums from the column sums
+               sum = 0.0;
+               squares = 0.0;
+               count = 0;
+               for (unsigned int windowCol = (col > mRadius) ? col - mRadius : 0;
+                  windowCol <= std::min(col + mRadius, mColSize - 1); ++windowCol)
+               {
+                  sum += mColumnSums[windowCol];
+                  squares += mColumnSquares[windowCol];
+                  count += mColumnCounts[windowCol];
+               }
+            }
+            else
+            {
+               if (col > mRadius)
+               {
+                  sum -= mColumnSums[col - mRadius - 1];
+                  squares -= mColumnSquares[col - mRadius - 1];
+                  count -= mColumnCounts[col - mRadius - 1];
+               }
+               if (col + mRadius < mColSize)
+               {
+                  sum += mColumnSums[col + mRadius];
+                  squares += mColumnSquares[col + mRadius];
+                  count += mColumnCounts[col + mRadius];
+               }
+            }
+
+            double value = std::numeric_limits<double>::quiet_NaN();
+            if (center.mValid[col] && count > 0)
+            {
+               double mean = sum / count;
+               double variance = std::max(0.0, squares / count - mean * mean);
+               mean += mShift;
+               switch (statistic)
+               {
+               case MEAN:
+                  value = mean;
+                  break;
+               case STANDARD_DEVIATION:
+                  value = sqrt(variance);
+                  break;
+               case CONTRAST:
+               {
+                  double rounding = count * std::numeric_limits<double>::epsilon() * (fabs(mShift) + sqrt(variance));
+                  value = (fabs(mean) > rounding) ? sqrt(variance) / mean : value;
+                  break;
+               }
+               default:
+                  break;
+               }
+            }
+            result[col] = value;
+         }
+         return true;
+      }
+
+   private:
+      bool readSource(unsigned int row)
+      {
+         if (!mReader.isValid())
+         {
+            return false;
+         }
+         if (row == 0)
+         {
+            switchOnEncoding(mType, findShift, mReader.getRow(), mColSize, mMask, mShift);
+         }
+         switchOnEncoding(mType, readRow, mReader.getRow(), mColSize, mMask, mShift, mRows[row % mRows.size()]);
+         mReader.nextRow();
+         return true;
+      }
+
+      void addRow(unsigned int row, double sign)
+      {
+         const ShiftedRow& source = mRows[row % mRows.size()];
+         int countSign = static_cast<int>(sign);
+         for (unsigned int col = 0; col < mColSize; ++col)
+         {
+            double value = source.mValues[col];
+            mColumnSums[col] += sign * value;
+            mColumnSquares[col] += sign * value * value;
+            mColumnCounts[col] += countSign * source.mValid[col];
+         }
+      }
+
+      //sums the window of rows around row from the ring
+      void rebuildColumns(unsigned int row)
+      {
+         mColumnSums.assign(mColSize, 0.0);
+         mColumnSquares.assign(mColSize, 0.0);
+         mColumnCounts.assign(mColSize, 0);
+         for (unsigned int windowRow = (row > mRadius) ? row - mRadius : 0;
+            windowRow <= std::min(row + mRadius, mRowCount - 1); ++windowRow)
+         {
+            addRow(windowRow, 1.0);
+         }
+      }
+
+      RowReader& mReader;
+      EncodingType mType;
+      unsigned int mColSize;
+      unsigned int mRowCount;
+      const BadValueMask& mMask;
+      unsigned int mRadius;
+      double mShift;
+      std::vector<ShiftedRow> mRows;
+      std::vector<double> mColumnSums;
+      std::vector<double> mColumnSquares;
+      std::vector<int> mColumnCounts;
+      unsigned int mNextSourceRow;
+      unsigned int mNextRow;
+   };
+}
+
+Tutorial10::Tutorial10()
+{
+   setDescriptorId("{C4D7E1A8-92B3-4F60-8E15-6A0D3B9F2C47}");
+   setName("Tutorial 10");
+   setDescription("Calculate the local mean, standard deviation or contrast of the first band of the provided raster "
+      "element over a square window around each pixel.");
+   setCreator("Opticks Community");
+   setVersion("Sample");
+   setCopyright("Copyright (C) 2008, Ball Aerospace & Technologies Corp.");
+   setProductionStatus(false);
+   setType("Sample");
+   setSubtype("Local Statistics");
+   setMenuLocation("[Tutorial]/Tutorial 10");
+   setAbortSupported(true);
+}
+
+Tutorial10::~Tutorial10()
+{
+}
+
+bool Tutorial10::getInputSpecification(PlugInArgList*& pInArgList)
+{
+   VERIFY(pInArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pInArgList->addArg<Progress>(Executable::ProgressArg(), NULL, "Progress reporter");
+   pInArgList->addArg<RasterElement>(Executable::DataElementArg(), "Calculate local statistics of the first band of this raster element");
+   pInArgList->addArg<std::string>("Statistic", std::string("Mean"), "The statistic to calculate around each pixel: Mean, "
+      "Standard Deviation, or Contrast (the standard deviation over the mean, NaN where the mean is 0)");
+   pInArgList->addArg<unsigned int>("Window Size", 31, "Width and height of the window in pixels, an odd number. The window "
+      "is clipped at the image edges.");
+   pInArgList->addArg<double>("No Data Value", "Pixels with this value are excluded, along with the bad values of the raster element");
+   pInArgList->addArg<std::string>("Output Type", std::string("FLT4"), "Data type of the result, FLT4 or FLT8. Bad pixels "
+      "are NaN.");
+   pInArgList->addArg<std::string>("Output File", std::string(), "Write the result straight into this raw file, with an ENVI "
+      "header beside it, instead of a raster element");
+   RowReader::addReadAheadArgs(pInArgList);
+   return true;
+}
+
+bool Tutorial10::getOutputSpecification(PlugInArgList*& pOutArgList)
+{
+   VERIFY(pOutArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pOutArgList->addArg<RasterElement>("Result", NULL);
+   return true;
+}
+
+bool Tutorial10::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
+{
+   DeferredStepResource pStep("Tutorial 10", "app", "5A93F0C2-7E41-4D18-B6A9-0C8E2D57F413");
+   if (pInArgList == NULL || pOutArgList == NULL)
+   {
+      return false;
+   }
+   Progress* pProgress = pInArgList->getPlugInArgValue<Progress>(Executable::ProgressArg());
+   RasterElement* pCube = pInArgList->getPlugInArgValue<RasterElement>(Executable::DataElementArg());
+   if (pCube == NULL)
+   {
+      std::string msg = "A raster cube must be specified.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   RasterDataDescriptor* pDesc = static_cast<RasterDataDescriptor*>(pCube->getDataDescriptor());
+   VERIFY(pDesc != NULL);
+
+   std::string statisticName = "Mean";
+   pInArgList->getPlugInArgValue("Statistic", statisticName);
+   Statistic statistic = MEAN;
+   std::string suffix = "_Local_Mean";
+   if (statisticName == "Standard Deviation")
+   {
+      statistic = STANDARD_DEVIATION;
+      suffix = "_Local_Standard_Deviation";
+   }
+   else if (statisticName == "Contrast")
+   {
+      statistic = CONTRAST;
+      suffix = "_Local_Contrast";
+   }
+   else if (statisticName != "Mean")
+   {
+      std::string msg = "The statistic must be Mean, Standard Deviation or Contrast.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   pStep->addProperty("Statistic", statisticName);
+
+   unsigned int windowSize = 31;
+   pInArgList->getPlugInArgValue("Window Size", windowSize);
+   if (windowSize % 2 == 0)
+   {
+      std::string msg = "The window size must be an odd number.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   pStep->addProperty("Window Size", windowSize);
+
+   std::string outputType = "FLT4";
+   pInArgList->getPlugInArgValue("Output Type", outputType);
+   if (outputType != "FLT4" && outputType != "FLT8")
+   {
+      std::string msg = "The output type must be FLT4 or FLT8.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   EncodingType resultType = (outputType == "FLT8") ? FLT8BYTES : FLT4BYTES;
+
+   double noDataValue = 0.0;
+   bool hasNoDataValue = pInArgList->getPlugInArgValue("No Data Value", noDataValue);
+   BadValueMask mask(pDesc, hasNoDataValue ? &noDataValue : NULL);
+
+   unsigned int readAheadRows = 0;
+   unsigned int readAheadDepth = 0;
+   RowReader::getReadAheadArgs(pInArgList, readAheadRows, readAheadDepth);
+
+   std::string outputFile;
+   pInArgList->getPlugInArgValue("Output File", outputFile);
+   bool toFile = !outputFile.empty();
+   unsigned int rowCount = pDesc->getRowCount();
+   unsigned int columnCount = pDesc->getColumnCount();
+   //the results of earlier runs are kept, each run gets a name of its own
+   std::string resultName = toFile ? std::string() : RowWriter::getUnusedElementName(pCube->getName() + suffix);
+   ModelResource<RasterElement> pResultCube(toFile ? NULL :
+      RasterUtilities::createRasterElement(resultName, rowCount, columnCount, resultType));
+   std::auto_ptr<RowWriter> pWriter;
+   if (toFile)
+   {
+      pWriter.reset(new RowWriter(outputFile, rowCount, columnCount, resultType));
+   }
+   else if (pResultCube.get() != NULL)
+   {
+      pWriter.reset(new RowWriter(pResultCube.get()));
+   }
+   if (pWriter.get() == NULL || !pWriter->isValid())
+   {
+      std::string msg = toFile ? "Unable to create the output file " + outputFile + "." :
+         "A raster cube could not be created.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+
+   //The source is read once, in order, and only the rows of one window are held at a time.
+   RowReader reader(pCube, 0, rowCount - 1, 0, columnCount - 1, readAheadRows, readAheadDepth);
+   LocalSums sums(reader, pDesc->getDataType(), columnCount, rowCount, mask, windowSize / 2);
+   std::vector<double> values;
+   for (unsigned int row = 0; row < rowCount; ++row)
+   {
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress("Calculating " + StringUtilities::toDisplayString(windowSize) + "x" +
+            StringUtilities::toDisplayString(windowSize) + " local statistics", row * 100 / rowCount, NORMAL);
+      }
+      if (isAborted())
+      {
+         std::string msg = getName() + " has been aborted.";
+         pStep->finalize(Message::Abort, msg);
+         if (pProgress != NULL)
+         {
+            pProgress->updateProgress(msg, 0, ABORT);
+         }
+         return false;
+      }
+      if (!sums.read(statistic, values) || !pWriter->isValid())
+      {
+         std::string msg = "Unable to access the cube data.";
+         pStep->finalize(Message::Failure, msg);
+         if (pProgress != NULL)
+         {
+            pProgress->updateProgress(msg, 0, ERRORS);
+         }
+         return false;
+      }
+
+      switchOnEncoding(resultType, writeValues, pWriter->getRow(), &values.front(), columnCount);
+      pWriter->nextRow();
+   }
+   //an output file is only kept, with its header, once every row is written
+   if (!pWriter->finish())
+   {
+      std::string msg = "Unable to write the output file " + outputFile + ".";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   pWriter.reset();
+
+   if (!toFile)
+   {
+      RasterElement* pResult = pResultCube.get();
+      if (!isBatch())
+      {
+         Service<DesktopServices> pDesktop;
+         SpatialDataWindow* pWindow = static_cast<SpatialDataWindow*>(pDesktop->createWindow(pResult->getName(),
+            SPATIAL_DATA_WINDOW));
+         SpatialDataView* pView = (pWindow == NULL) ? NULL : pWindow->getSpatialDataView();
+         if (pView == NULL)
+         {
+            std::string msg = "Unable to create view.";
+            pStep->finalize(Message::Failure, msg);
+            if (pProgress != NULL)
+            {
+               pProgress->updateProgress(msg, 0, ERRORS);
+            }
+            return false;
+         }
+         pView->setPrimaryRasterElement(pResult);
+         pView->createLayer(RASTER, pResult);
+      }
+      pResultCube.release();
+      pOutArgList->setPlugInArgValue("Result", pResult);
+   }
+
+   if (pProgress != NULL)
+   {
+      pProgress->updateProgress("Tutorial 10 is complete.", 100, NORMAL);
+   }
+   pStep->finalize();
+   return true;
+}
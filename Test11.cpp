@@ -0,0 +1,198 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "AppVerify.h"
+#include "MessageLogResource.h"
+#include "PlugInArgList.h"
+#include "PlugInManagerServices.h"
+#include "PlugInRegistration.h"
+#include "PlugInResource.h"
+#include "Progress.h"
+#include "RasterElement.h"
+#include "StepLog.h"
+#include "StringUtilities.h"
+#include "Test11.h"
+#include <QtCore/QTime>
+#include <algorithm>
+
+REGISTER_PLUGIN_BASIC(OpticksTutorial, Tutorial11);
+
+namespace
+{
+   //puts the StepLog settings back as they were when it goes away, however the measurement ends
+   class StepLogSettings
+   {
+   public:
+      StepLogSettings() :
+         mDeferred(StepLog::isDeferred()),
+         mVerbosity(StepLog::getVerbosity())
+      {
+      }
+
+      ~StepLogSettings()
+      {
+         StepLog::setDeferred(mDeferred);
+         StepLog::setVerbosity(mVerbosity);
+      }
+
+   private:
+      StepLogSettings(const StepLogSettings& rhs);
+      StepLogSettings& operator=(const StepLogSettings& rhs);
+
+      bool mDeferred;
+      StepLog::Verbosity mVerbosity;
+   };
+
+   //runs the plug-in runs times with the given logging and returns the invocations per second, including the time
+   //to write any deferred steps
+   double measure(const std::string& plugInName, RasterElement* pElement, unsigned int runs, bool deferred,
+      StepLog::Verbosity verbosity, unsigned int& failures)
+   {
+      StepLogSettings settings;
+      StepLog::setDeferred(deferred);
+      StepLog::setVerbosity(verbosity);
+      QTime timer;
+      timer.start();
+      for (unsigned int run = 0; run < runs; ++run)
+      {
+         ExecutableResource pPlugIn(plugInName, std::string(), NULL, true);
+         if (pElement != NULL)
+         {
+            pPlugIn->getInArgList().setPlugInArgValue<RasterElement>(Executable::DataElementArg(), pElement);
+         }
+         if (!pPlugIn->execute())
+         {
+            ++failures;
+         }
+      }
+      StepLog::flush();
+      int elapsed = timer.elapsed();
+      return runs * 1000.0 / std::max(elapsed, 1);
+   }
+}
+
+Tutorial11::Tutorial11()
+{
+   setDescriptorId("{7D2E5B84-0A6F-4C91-B3E7-D8145F62A09C}");
+   setName("Tutorial 11");
+   setDescription("Setting how the tutorials write their steps to the message log, and measuring it.");
+   setCreator("Opticks Community");
+   setVersion("Sample");
+   setCopyright("Copyright (C) 2008, Ball Aerospace & Technologies Corp.");
+   setProductionStatus(false);
+   setType("Sample");
+   setSubtype("Logging");
+   setMenuLocation("[Tutorial]/Tutorial 11");
+   setAbortSupported(false);
+}
+
+Tutorial11::~Tutorial11()
+{
+}
+
+bool Tutorial11::getInputSpecification(PlugInArgList*& pInArgList)
+{
+   VERIFY(pInArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pInArgList->addArg<Progress>(Executable::ProgressArg(), NULL, "Progress reporter");
+   pInArgList->addArg<bool>("Deferred", false, "Record the steps of the tutorials and write them to the message log in "
+      "batches from the main thread's event loop, for the rest of the session");
+   pInArgList->addArg<std::string>("Verbosity", std::string("All"), "All to log every step, Failures to log only the "
+      "steps which fail or are aborted");
+   pInArgList->addArg<std::string>("Measure Plug-In", std::string(), "Before applying the settings, run this plug-in "
+      "in batch mode with steps written straight away and then deferred, and report the invocations per second of each");
+   pInArgList->addArg<unsigned int>("Measure Runs", 100, "Times the plug-in is run for each measurement");
+   pInArgList->addArg<RasterElement>(Executable::DataElementArg(), NULL, "Raster element passed to the measured plug-in");
+   return true;
+}
+
+bool Tutorial11::getOutputSpecification(PlugInArgList*& pOutArgList)
+{
+   VERIFY(pOutArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pOutArgList->addArg<double>("Immediate Rate", "Invocations per second of the measured plug-in with its steps written straight away");
+   pOutArgList->addArg<double>("Deferred Rate", "Invocations per second of the measured plug-in with its steps deferred");
+   return true;
+}
+
+bool Tutorial11::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
+{
+   StepResource pStep("Tutorial 11", "app", "E40C8A15-93D7-4B2F-A61E-5F3B09D7C824");
+   if (pInArgList == NULL || pOutArgList == NULL)
+   {
+      return false;
+   }
+   Progress* pProgress = pInArgList->getPlugInArgValue<Progress>(Executable::ProgressArg());
+
+   bool deferred = false;
+   pInArgList->getPlugInArgValue("Deferred", deferred);
+   std::string verbosityName = "All";
+   pInArgList->getPlugInArgValue("Verbosity", verbosityName);
+   if (verbosityName != "All" && verbosityName != "Failures")
+   {
+      std::string msg = "The verbosity must be All or Failures.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   StepLog::Verbosity verbosity = (verbosityName == "Failures") ? StepLog::FAILURES : StepLog::ALL;
+
+   std::string plugInName;
+   pInArgList->getPlugInArgValue("Measure Plug-In", plugInName);
+   if (!plugInName.empty())
+   {
+      if (ExecutableResource(plugInName, std::string(), NULL, true)->getPlugIn() == NULL)
+      {
+         std::string msg = "The plug-in " + plugInName + " could not be found.";
+         pStep->finalize(Message::Failure, msg);
+         if (pProgress != NULL)
+         {
+            pProgress->updateProgress(msg, 0, ERRORS);
+         }
+         return false;
+      }
+
+      unsigned int runs = 100;
+      pInArgList->getPlugInArgValue("Measure Runs", runs);
+      RasterElement* pElement = pInArgList->getPlugInArgValue<RasterElement>(Executable::DataElementArg());
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress("Measuring " + plugInName + " with steps written straight away", 0, NORMAL);
+      }
+      unsigned int failures = 0;
+      double immediateRate = measure(plugInName, pElement, runs, false, verbosity, failures);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress("Measuring " + plugInName + " with deferred steps", 50, NORMAL);
+      }
+      double deferredRate = measure(plugInName, pElement, runs, true, verbosity, failures);
+
+      pStep->addProperty("Measured Plug-In", plugInName);
+      pStep->addProperty("Measure Runs", runs);
+      pStep->addProperty("Failed Runs", failures);
+      pStep->addProperty("Immediate Rate", immediateRate);
+      pStep->addProperty("Deferred Rate", deferredRate);
+      pOutArgList->setPlugInArgValue("Immediate Rate", &immediateRate);
+      pOutArgList->setPlugInArgValue("Deferred Rate", &deferredRate);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(plugInName + " ran " + StringUtilities::toDisplayString(immediateRate) +
+            " times per second with steps written straight away and " + StringUtilities::toDisplayString(deferredRate) +
+            " times per second with deferred steps.", 100, NORMAL);
+      }
+   }
+
+   StepLog::setDeferred(deferred);
+   StepLog::setVerbosity(verbosity);
+   pStep->addProperty("Deferred", deferred);
+   pStep->addProperty("Verbosity", verbosityName);
+   pStep->finalize();
+   return true;
+}
@@ -15,6 +15,7 @@
 #include "PlugInRegistration.h"
 #include "PlugInResource.h"
 #include "Progress.h"
+#include "StepLog.h"
 #include "StringUtilities.h"
 #include "Test2.h"
 #ifdef WIN_API
@@ -63,7 +64,7 @@ bool Tutorial2::getOutputSpecification(PlugInArgList*& pOutArgList)
 
 bool Tutorial2::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
 {
-   StepResource pStep("Tutorial 2", "app", "A8FEFCB3-5D08-4670-B47E-CC533A932737"); //this info is also used by the message log window in order to identify the plugin from which it was logged. semantics: description, { component(name), key } - unique ID
+   DeferredStepResource pStep("Tutorial 2", "app", "A8FEFCB3-5D08-4670-B47E-CC533A932737"); //this info is also used by the message log window in order to identify the plugin from which it was logged. semantics: description, { component(name), key } - unique ID
    if (pInArgList == NULL)
    {
       return false;
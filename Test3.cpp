@@ -9,9 +9,13 @@
 
 #include "AppConfig.h"
 #include "AppVerify.h"
+#include "BadValueMask.h"
+#include "BandMath.h"
+#include "BatchKernel.h"
 #include "DataAccessor.h"
 #include "DataAccessorImpl.h"
 #include "DataRequest.h"
+#include "IntegerStatistics.h"
 #include "MessageLogResource.h"
 #include "ObjectResource.h"
 #include "PlugInArgList.h"
@@ -21,26 +25,558 @@
 #include "Progress.h"
 #include "RasterDataDescriptor.h"
 #include "RasterElement.h"
+#include "RowReader.h"
+#include "RowStripWorker.h"
+#include "StepLog.h"
 #include "StringUtilities.h"
 #include "switchOnEncoding.h"
 #include "Test3.h"
+#include "Test6.h"
+#include <algorithm>
+#include <cmath>
 #include <limits>
+#include <memory>
+#include <vector>
 
 REGISTER_PLUGIN_BASIC(OpticksTutorial, Tutorial3); //why is this required?
 
 namespace 
 {
-	//defnining a template which updates the min, max and the total by comparison with the data of typename T
+   // bins used for encodings which cannot be histogrammed exactly, and for each percentile refinement level
+   const unsigned int sRefineBinCount = 4096;
+
+   // once a percentile's bin holds no more than this many pixels, its values are collected and selected directly
+   const unsigned int sMaxCollectedValues = 1 << 20;
+
+   // bound on refinement levels; only reached by bins holding a few adjacent doubles
+   const unsigned int sMaxRefineLevels = 8;
+
+   //exact one-bin-per-value histograms are only kept for 8 and 16 bit integer encodings
    template<typename T>
-   void updateStatistics(T* pData, double& min, double& max, double& total)
+   struct ExactHistogram
+   {
+      static const unsigned int sBinCount = 0;
+      static unsigned int getBin(T value) { return 0; }
+   };
+
+   template<>
+   struct ExactHistogram<unsigned char>
+   {
+      static const unsigned int sBinCount = 256;
+      static unsigned int getBin(unsigned char value) { return value; }
+   };
+
+   template<>
+   struct ExactHistogram<signed char>
    {
-      min = std::min(min, static_cast<double>(*pData));
-      max = std::max(max, static_cast<double>(*pData));
-      total += *pData;
+      static const unsigned int sBinCount = 256;
+      static unsigned int getBin(signed char value) { return static_cast<unsigned int>(value + 128); }
+   };
+
+   template<>
+   struct ExactHistogram<unsigned short>
+   {
+      static const unsigned int sBinCount = 65536;
+      static unsigned int getBin(unsigned short value) { return value; }
+   };
+
+   template<>
+   struct ExactHistogram<signed short>
+   {
+      static const unsigned int sBinCount = 65536;
+      static unsigned int getBin(signed short value) { return static_cast<unsigned int>(value + 32768); }
+   };
+
+   template<typename T>
+   void getExactHistogramBins(T* pData, unsigned int& binCount, double& firstBinValue)
+   {
+      binCount = ExactHistogram<T>::sBinCount;
+      firstBinValue = (binCount == 0) ? 0.0 : static_cast<double>(std::numeric_limits<T>::min());
+   }
+
+   struct Statistics
+   {
+      Statistics(unsigned int binCount) :
+         mMin(std::numeric_limits<double>::max()),
+         mMax(-std::numeric_limits<double>::max()),
+         mTotal(0.0),
+         mCount(0),
+         mHistogram(binCount, 0)
+      {
+      }
+
+      void merge(const Statistics& other)
+      {
+         mMin = std::min(mMin, other.mMin);
+         mMax = std::max(mMax, other.mMax);
+         mTotal += other.mTotal;
+         mCount += other.mCount;
+         for (unsigned int bin = 0; bin < mHistogram.size(); ++bin)
+         {
+            mHistogram[bin] += other.mHistogram[bin];
+         }
+      }
+
+      double mMin;
+      double mMax;
+      double mTotal;
+      unsigned int mCount;
+      std::vector<unsigned int> mHistogram;
+   };
+
+	//updates the min, max and the total for a whole row of data of typename T, and the exact histogram if the type has one
+	//bad values are blended out rather than branched around, so the loop stays the same with or without them
+   template<typename T>
+   void updateStatistics(T* pData, unsigned int columnCount, const BadValueMask& mask, Statistics& stats)
+   {
+      //8 and 16 bit integers are compared and summed in their own type instead
+      if (IntegerStatistics<T>::sSupported)
+      {
+         IntegerStatistics<T>::addRow(pData, columnCount, mask.getIntegerValues(), NULL,
+            stats.mHistogram.empty() ? NULL : &stats.mHistogram.front(), stats.mMin, stats.mMax, stats.mTotal,
+            stats.mCount);
+         return;
+      }
+
+      for (unsigned int col = 0; col < columnCount; ++col)
+      {
+         double value = static_cast<double>(pData[col]);
+         bool valid = mask.isValid(value);
+         stats.mMin = std::min(stats.mMin, valid ? value : std::numeric_limits<double>::max());
+         stats.mMax = std::max(stats.mMax, valid ? value : -std::numeric_limits<double>::max());
+         stats.mTotal += valid ? value : 0.0;
+         stats.mCount += valid;
+         if (ExactHistogram<T>::sBinCount > 0)
+         {
+            stats.mHistogram[ExactHistogram<T>::getBin(pData[col])] += valid;
+         }
+      }
+   }
+
+   class StatisticsWorker : public RowStripWorker
+   {
+   public:
+      StatisticsWorker(RasterElement* pCube, RowStripReaders& readers, unsigned int strip, QAtomicInt& rowsDone,
+         QAtomicInt& aborted, const BadValueMask& mask, unsigned int binCount) :
+         RowStripWorker(pCube, readers, strip, rowsDone, aborted),
+         mMask(mask),
+         mStats(binCount)
+      {
+      }
+
+      const BadValueMask& mMask;
+      Statistics mStats;
+
+   protected:
+      virtual void processRow(void* pRow, unsigned int row)
+      {
+         switchOnEncoding(getDataType(), updateStatistics, pRow, getColumnCount(), mMask, mStats);
+      }
+   };
+
+   //one level of histogram refinement, covering [mStart, mStart + sRefineBinCount / mScale)
+   struct HistogramLevel
+   {
+      HistogramLevel(double start, double scale) : mStart(start), mScale(scale), mBin(0) {}
+
+      unsigned int getBin(double value) const
+      {
+         double offset = (value - mStart) * mScale;
+         if (!(offset > 0.0))
+         {
+            return 0;
+         }
+         return (offset >= sRefineBinCount) ? sRefineBinCount - 1 : static_cast<unsigned int>(offset);
+      }
+
+      HistogramLevel refine(unsigned int bin) const
+      {
+         return HistogramLevel(mStart + bin / mScale, mScale * sRefineBinCount);
+      }
+
+      double mStart;
+      double mScale;
+      unsigned int mBin;
+   };
+
+   //narrows in on the value of the given 1-based rank, one pass over the data per level
+   struct PercentileSearch
+   {
+      PercentileSearch(const HistogramLevel& firstLevel) :
+         mRank(1),
+         mNext(firstLevel),
+         mCollect(false),
+         mResolved(false),
+         mValue(0.0)
+      {
+      }
+
+      bool isCandidate(double value) const
+      {
+         if (value != value)
+         {
+            return false;
+         }
+         for (std::vector<HistogramLevel>::const_iterator it = mChosen.begin(); it != mChosen.end(); ++it)
+         {
+            if (it->getBin(value) != it->mBin)
+            {
+               return false;
+            }
+         }
+         return true;
+      }
+
+      //descends into the histogram bin holding mRank, returns false if the histogram holds no candidates
+      bool descend(const std::vector<unsigned int>& histogram)
+      {
+         unsigned int before = 0;
+         for (unsigned int bin = 0; bin < histogram.size(); ++bin)
+         {
+            if (before + histogram[bin] >= mRank)
+            {
+               mRank -= before;
+               mNext.mBin = bin;
+               mChosen.push_back(mNext);
+               mNext = mNext.refine(bin);
+               mCollect = histogram[bin] <= sMaxCollectedValues || mChosen.size() >= sMaxRefineLevels;
+               return true;
+            }
+            before += histogram[bin];
+         }
+         return false;
+      }
+
+      unsigned int mRank;
+      std::vector<HistogramLevel> mChosen;
+      HistogramLevel mNext;
+      bool mCollect;
+      bool mResolved;
+      double mValue;
+   };
+
+   //nearest-rank definition: the smallest value with at least percentile% of the pixels at or below it
+   unsigned int getPercentileRank(double percentile, unsigned int count)
+   {
+      double rank = std::ceil(percentile / 100.0 * count);
+      return static_cast<unsigned int>(std::max(1.0, std::min(rank, static_cast<double>(count))));
+   }
+
+   class PercentileWorker : public RowStripWorker
+   {
+   public:
+      PercentileWorker(RasterElement* pCube, RowStripReaders& readers, unsigned int strip, QAtomicInt& rowsDone,
+         QAtomicInt& aborted, const BadValueMask& mask, const std::vector<PercentileSearch>& searches,
+         bool firstPass) :
+         RowStripWorker(pCube, readers, strip, rowsDone, aborted),
+         mMask(mask),
+         mSearches(searches),
+         mFirstPass(firstPass),
+         mHistograms(searches.size()),
+         mValues(searches.size()),
+         mMin(searches.size(), std::numeric_limits<double>::max()),
+         mMax(searches.size(), -std::numeric_limits<double>::max())
+      {
+         for (unsigned int i = 0; i < mSearches.size(); ++i)
+         {
+            if (!mSearches[i].mResolved && !mSearches[i].mCollect && (i == 0 || !mFirstPass))
+            {
+               mHistograms[i].resize(sRefineBinCount, 0);
+            }
+         }
+      }
+
+      void addValue(double value)
+      {
+         if (!mMask.isValid(value))
+         {
+            return;
+         }
+
+         if (mFirstPass)
+         {
+            //every search starts from the same level, so the first histogram is shared
+            if (value == value)
+            {
+               ++mHistograms[0][mSearches[0].mNext.getBin(value)];
+            }
+            return;
+         }
+
+         for (unsigned int i = 0; i < mSearches.size(); ++i)
+         {
+            const PercentileSearch& search = mSearches[i];
+            if (search.mResolved || !search.isCandidate(value))
+            {
+               continue;
+            }
+            mMin[i] = std::min(mMin[i], value);
+            mMax[i] = std::max(mMax[i], value);
+            if (search.mCollect)
+            {
+               mValues[i].push_back(value);
+            }
+            else
+            {
+               ++mHistograms[i][search.mNext.getBin(value)];
+            }
+         }
+      }
+
+      const BadValueMask& mMask;
+      const std::vector<PercentileSearch>& mSearches;
+      bool mFirstPass;
+      std::vector<std::vector<unsigned int> > mHistograms;
+      std::vector<std::vector<double> > mValues;
+      std::vector<double> mMin;
+      std::vector<double> mMax;
+
+   protected:
+      virtual void processRow(void* pRow, unsigned int row);
+   };
+
+   template<typename T>
+   void refinePercentiles(T* pData, unsigned int columnCount, PercentileWorker& worker)
+   {
+      for (unsigned int col = 0; col < columnCount; ++col)
+      {
+         worker.addValue(static_cast<double>(pData[col]));
+      }
+   }
+
+   void PercentileWorker::processRow(void* pRow, unsigned int row)
+   {
+      switchOnEncoding(getDataType(), refinePercentiles, pRow, getColumnCount(), *this);
+   }
+
+   //One run of Tutorial 3, from its checked inputs to its results. compute() only reads the cube through the strip
+   //readers prepareBatch() created, and leaves the step and the outputs to finishBatch().
+   class StatisticsKernel : public BatchKernel
+   {
+   public:
+      StatisticsKernel() :
+         mStep("Tutorial 3", "app", "27170298-10CE-4E6C-AD7A-97E8058C29FF"),
+         mpProgress(NULL),
+         mpCube(NULL),
+         mBandMask(NULL),
+         mMask(NULL),
+         mpExpression(NULL),
+         mDataType(FLT8BYTES),
+         mComputed(false),
+         mMin(0.0),
+         mMax(0.0),
+         mTotal(0.0),
+         mCount(0),
+         mHistogramMinimum(0.0),
+         mHistogramBinWidth(1.0)
+      {
+      }
+
+      virtual bool compute(QAtomicInt& aborted);
+
+      DeferredStepResource mStep;
+      Progress* mpProgress;
+      RasterElement* mpCube;
+      std::vector<double> mPercentiles;
+      std::auto_ptr<RowStripReaders> mpReaders; //one strip per thread, read again by each pass
+      BadValueMask mBandMask;
+      BadValueMask mMask;
+      BandMathExpression mExpression;
+      const BandMathExpression* mpExpression;
+      EncodingType mDataType;
+
+      bool mComputed;
+      std::string mFailure; //why compute() failed, empty if it was aborted
+      double mMin;
+      double mMax;
+      double mTotal;
+      unsigned int mCount;
+      std::vector<double> mPercentileValues; //the requested percentiles, then the median
+      std::vector<unsigned int> mHistogram;
+      double mHistogramMinimum;
+      double mHistogramBinWidth;
+   };
+
+   bool StatisticsKernel::compute(QAtomicInt& aborted)
+   {
+      const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(mpCube->getDataDescriptor());
+
+      //8 and 16 bit integers are histogrammed exactly in the statistics pass, everything else is refined afterwards
+      unsigned int binCount = 0;
+      switchOnEncoding(mDataType, getExactHistogramBins, NULL, binCount, mHistogramMinimum);
+
+      //The rows are split into strips, each processed on its own thread with its own readers. The partial results are merged afterwards.
+      RowStripReaders& readers = *mpReaders;
+      RowStripThreadGroup statisticsWorkers;
+      QAtomicInt rowsDone(0);
+      for (unsigned int strip = 0; strip < readers.getStripCount(); ++strip)
+      {
+         StatisticsWorker* pWorker = new StatisticsWorker(mpCube, readers, strip, rowsDone, aborted, mMask, binCount);
+         pWorker->setExpression(mpExpression, &mBandMask);
+         statisticsWorkers.addWorker(pWorker);
+      }
+      if (!statisticsWorkers.run(rowsDone, pDesc->getRowCount(), aborted, mpProgress, "Calculating statistics", 0,
+         (binCount > 0) ? 100 : 50))
+      {
+         mFailure = (aborted != 0) ? std::string() : "Unable to access the cube data.";
+         return false;
+      }
+
+      Statistics stats(binCount);
+      for (unsigned int worker = 0; worker < statisticsWorkers.getWorkerCount(); ++worker)
+      {
+         stats.merge(static_cast<StatisticsWorker*>(statisticsWorkers.getWorker(worker))->mStats);
+      }
+      mMin = stats.mMin;
+      mMax = stats.mMax;
+      mTotal = stats.mTotal;
+      mCount = stats.mCount; //number of pixels which are not bad values.
+      if (mCount == 0)
+      {
+         mFailure = "The raster element has no valid pixels.";
+         return false;
+      }
+
+      //the median is searched for alongside the requested percentiles, as the last entry
+      std::vector<double> searchPercentiles(mPercentiles);
+      searchPercentiles.push_back(50.0);
+      mPercentileValues.assign(searchPercentiles.size(), 0.0);
+      if (binCount > 0)
+      {
+         unsigned int histogramCount = 0;
+         for (unsigned int bin = 0; bin < binCount; ++bin)
+         {
+            histogramCount += stats.mHistogram[bin];
+         }
+         for (unsigned int i = 0; i < searchPercentiles.size(); ++i)
+         {
+            PercentileSearch search(HistogramLevel(0.0, 1.0));
+            search.mRank = getPercentileRank(searchPercentiles[i], histogramCount);
+            search.descend(stats.mHistogram);
+            mPercentileValues[i] = mHistogramMinimum + search.mChosen.front().mBin;
+         }
+         mHistogram.swap(stats.mHistogram);
+      }
+      else if (!(mMax > mMin))
+      {
+         //a single value (or nothing but NaN), so every percentile is that value
+         mHistogramMinimum = mMin;
+         mHistogramBinWidth = 0.0;
+         mHistogram.resize(sRefineBinCount, 0);
+         mHistogram[0] = mCount;
+         mPercentileValues.assign(searchPercentiles.size(), mMin);
+      }
+      else
+      {
+         //Adaptive refinement: histogram over [min, max], then keep histogramming just the bin holding each
+         //percentile until few enough values remain to collect and select exactly. Memory stays bounded by
+         //sRefineBinCount and sMaxCollectedValues, whatever the size of the cube.
+         HistogramLevel firstLevel(mMin, sRefineBinCount / (mMax - mMin));
+         std::vector<PercentileSearch> searches(searchPercentiles.size(), PercentileSearch(firstLevel));
+         for (unsigned int pass = 0; ; ++pass)
+         {
+            bool done = true;
+            for (std::vector<PercentileSearch>::const_iterator it = searches.begin(); it != searches.end(); ++it)
+            {
+               done = done && it->mResolved;
+            }
+            if (done)
+            {
+               break;
+            }
+
+            RowStripThreadGroup percentileWorkers;
+            rowsDone = 0;
+            for (unsigned int strip = 0; strip < readers.getStripCount(); ++strip)
+            {
+               PercentileWorker* pWorker = new PercentileWorker(mpCube, readers, strip, rowsDone, aborted, mMask,
+                  searches, pass == 0);
+               pWorker->setExpression(mpExpression, &mBandMask);
+               percentileWorkers.addWorker(pWorker);
+            }
+            int startPercent = std::min(99, 50 + 25 * static_cast<int>(pass));
+            if (!percentileWorkers.run(rowsDone, pDesc->getRowCount(), aborted, mpProgress,
+               "Calculating percentiles", startPercent, std::min(99, startPercent + 25)))
+            {
+               mFailure = (aborted != 0) ? std::string() : "Unable to access the cube data.";
+               return false;
+            }
+
+            for (unsigned int i = 0; i < searches.size(); ++i)
+            {
+               PercentileSearch& search = searches[i];
+               if (search.mResolved)
+               {
+                  continue;
+               }
+
+               std::vector<unsigned int> levelHistogram(sRefineBinCount, 0);
+               std::vector<double> values;
+               double candidateMin = std::numeric_limits<double>::max();
+               double candidateMax = -candidateMin;
+               for (unsigned int worker = 0; worker < percentileWorkers.getWorkerCount(); ++worker)
+               {
+                  PercentileWorker* pWorker = static_cast<PercentileWorker*>(percentileWorkers.getWorker(worker));
+                  const std::vector<unsigned int>& workerHistogram = pWorker->mHistograms[(pass == 0) ? 0 : i];
+                  for (unsigned int bin = 0; bin < workerHistogram.size(); ++bin)
+                  {
+                     levelHistogram[bin] += workerHistogram[bin];
+                  }
+                  values.insert(values.end(), pWorker->mValues[i].begin(), pWorker->mValues[i].end());
+                  candidateMin = std::min(candidateMin, pWorker->mMin[i]);
+                  candidateMax = std::max(candidateMax, pWorker->mMax[i]);
+               }
+
+               if (pass == 0)
+               {
+                  if (i == 0)
+                  {
+                     mHistogram = levelHistogram;
+                     mHistogramMinimum = mMin;
+                     mHistogramBinWidth = (mMax - mMin) / sRefineBinCount;
+                  }
+                  unsigned int histogramCount = 0;
+                  for (unsigned int bin = 0; bin < sRefineBinCount; ++bin)
+                  {
+                     histogramCount += levelHistogram[bin];
+                  }
+                  search.mRank = getPercentileRank(searchPercentiles[i], histogramCount);
+               }
+               else if (candidateMin == candidateMax)
+               {
+                  search.mValue = candidateMin;
+                  search.mResolved = true;
+                  continue;
+               }
+
+               //a search cannot run out of candidates, but VERIFY would log from what may be a pool thread
+               if (search.mCollect && search.mRank <= values.size())
+               {
+                  std::nth_element(values.begin(), values.begin() + (search.mRank - 1), values.end());
+                  search.mValue = values[search.mRank - 1];
+                  search.mResolved = true;
+               }
+               else if (search.mCollect || !search.descend(levelHistogram))
+               {
+                  mFailure = "The percentiles could not be found.";
+                  return false;
+               }
+            }
+         }
+
+         for (unsigned int i = 0; i < searches.size(); ++i)
+         {
+            mPercentileValues[i] = searches[i].mValue;
+         }
+      }
+
+      mComputed = true;
+      return true;
    }
 };
 
-Tutorial3::Tutorial3() //The semantics of this method is the same as the previous ones.
+Tutorial3::Tutorial3() : //The semantics of this method is the same as the previous ones.
+   mAborted(0)
 {
    setDescriptorId("{2073076C-2676-45B9-AA7B-A2607104655C}");
    setName("Tutorial 3");
@@ -64,6 +600,17 @@ bool Tutorial3::getInputSpecification(PlugInArgList* &pInArgList)
    VERIFY(pInArgList = Service<PlugInManagerServices>()->getPlugInArgList()); //verify that the plugins exist and get the argument list.
    pInArgList->addArg<Progress>(Executable::ProgressArg(), NULL, "Progress reporter"); //to the current input argument list, add the Progress bar argument.
    pInArgList->addArg<RasterElement>(Executable::DataElementArg(), "Generate statistics for this raster element"); //Add a data element argument also.. so that the data (in terms of pixel values) can be extracted from the raster element. Hence, this is of the typename "RasterElement"
+   std::vector<double> percentiles;
+   percentiles.push_back(2.0);
+   percentiles.push_back(98.0);
+   pInArgList->addArg<std::vector<double> >("Percentiles", percentiles, "Percentiles (0 to 100) to calculate in addition to the median");
+   pInArgList->addArg<unsigned int>("Level", 0, "Generate statistics for this pyramid level, built by Tutorial 6 if needed. 0 is full resolution.");
+   pInArgList->addArg<double>("No Data Value", "Pixels with this value are excluded, along with the bad values of the raster element");
+   RowReader::addReadAheadArgs(pInArgList);
+   pInArgList->addArg<unsigned int>("Thread Count", 0, "Number of threads to calculate on. 0 uses one per processor.");
+   pInArgList->addArg<std::string>("Expression", std::string(), "Generate statistics for this band math expression, such as "
+      "(b4 - b3) / (b4 + b3), instead of the first band. It is evaluated as the rows are read, without creating a raster "
+      "element for it. Pixels where it uses a bad value, or which are not a number, are excluded.");
    return true;
 }
 
@@ -73,18 +620,36 @@ bool Tutorial3::getOutputSpecification(PlugInArgList*& pOutArgList) //so far, th
    //Append the list of arguments that are supposed to be output by the plugin. This can also be used for chaining the plugins. i.e, the output of one plugin can be given as the input to another.
    pOutArgList->addArg<double>("Minimum", "The minimum value"); //template TypeName - int, float, double, long etc.. syntax: name, description
    pOutArgList->addArg<double>("Maximum", "The maximum value");
-   pOutArgList->addArg<unsigned int>("Count", "The number of pixels");
+   pOutArgList->addArg<unsigned int>("Count", "The number of valid pixels");
    pOutArgList->addArg<double>("Mean", "The average value");
+   pOutArgList->addArg<double>("Median", "The median value");
+   pOutArgList->addArg<std::vector<double> >("Percentile Values", "The value at each of the requested percentiles");
+   pOutArgList->addArg<std::vector<unsigned int> >("Histogram", "The number of pixels in each histogram bin");
+   pOutArgList->addArg<double>("Histogram Minimum", "The value at the start of the first histogram bin");
+   pOutArgList->addArg<double>("Histogram Bin Width", "The width of each histogram bin");
    return true;
 }
 
 bool Tutorial3::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
 {
-   StepResource pStep("Tutorial 3", "app", "27170298-10CE-4E6C-AD7A-97E8058C29FF");
-   if (pInArgList == NULL || pOutArgList == NULL) //check for both values, since this plugin has both input and the output.
+   //The run is split so that Tutorial 7 can do the calculation on its own threads, see BatchKernel.h.
+   std::auto_ptr<BatchKernel> pKernel(prepareBatch(pInArgList));
+   if (pKernel.get() == NULL)
    {
       return false;
    }
+   pKernel->compute(mAborted);
+   return finishBatch(pKernel.get(), pOutArgList);
+}
+
+BatchKernel* Tutorial3::prepareBatch(PlugInArgList* pInArgList)
+{
+   std::auto_ptr<StatisticsKernel> pKernel(new StatisticsKernel);
+   DeferredStep* pStep = pKernel->mStep.get();
+   if (pInArgList == NULL) //check for the input, the output is only needed by finishBatch().
+   {
+      return NULL;
+   }
    Progress* pProgress = pInArgList->getPlugInArgValue<Progress>(Executable::ProgressArg()); //to obtain a progress bar interface.
    RasterElement* pCube = pInArgList->getPlugInArgValue<RasterElement> (Executable::DataElementArg());
    //pcube is a pointer to the raster element. i.e, pcube can be used to access the spatial data. For this to work, a dataelement must be initially open. In simple terms, an image must be open to work on. This data is accessible through 'Executable::DataElementArg()'
@@ -98,82 +663,147 @@ bool Tutorial3::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
          pProgress->updateProgress(msg, 0, ERRORS);
       }
 
-      return false;
+      return NULL;
    }
    //A data element is analogous to an open image data.
    //DataElement has a DataDescriptor, RasterElement has a RastorDataDescriptor
 
-   RasterDataDescriptor* pDesc = static_cast<RasterDataDescriptor*>(pCube->getDataDescriptor()); //RastorElement always has a RastorDataDescriptor. so static casting is safe.
-   VERIFY(pDesc != NULL);
+   unsigned int level = 0;
+   pInArgList->getPlugInArgValue("Level", level);
+   if (level > 0)
+   {
+      //run on a reduced resolution overview instead of the full cube
+      pCube = Tutorial6::getLevel(pCube, level, pProgress);
+      if (pCube == NULL)
+      {
+         std::string msg = "Pyramid level " + StringUtilities::toDisplayString(level) + " is not available.";
+         pStep->finalize(Message::Failure, msg);
+         if (pProgress != NULL)
+         {
+            pProgress->updateProgress(msg, 0, ERRORS);
+         }
 
-   FactoryResource<DataRequest> pRequest; //this resource is a datarequest resouce. pRequest can henceforth be used to access the data elements. i.e, it sets the rows, columns and bands that need to be accessed at a particular time. This is more of an optimization criteria.
-   pRequest->setInterleaveFormat(BSQ); //Didnt understand what an interleaving format is, and why it is being set to BSQ.
+         return NULL;
+      }
+   }
 
-   DataAccessor pAcc = pCube->getDataAccessor(pRequest.release()); //pAcc is used to access the raster data. Its value is got from the pointer to the raster element (pCube). And the mode of the request is set to release. I clearly didnt understand what removal of ownership of underlying obect meant.
+   RasterDataDescriptor* pDesc = static_cast<RasterDataDescriptor*>(pCube->getDataDescriptor()); //RastorElement always has a RastorDataDescriptor. so static casting is safe.
+   VERIFYRV(pDesc != NULL, NULL);
 
-   //dealing with a single band of raster data.
-   double min = std::numeric_limits<double>::max(); //this is done so as remove make the code independent of the underlying platform. Here, min is being set to global max and max is being set to global numerical min (-ve max).
-   double max = -min;
-   double total = 0.0;
-   for (unsigned int row = 0; row < pDesc->getRowCount(); ++row)
+   std::vector<double> percentiles;
+   pInArgList->getPlugInArgValue("Percentiles", percentiles);
+   for (std::vector<double>::const_iterator it = percentiles.begin(); it != percentiles.end(); ++it)
    {
-
-	   //OK, heres the idea. first check for all the errors and return false appropriately. THEN, if everything is right, go for the computation!
-
-      if (isAborted()) //on every loop, check whether the status is aborted. But isnt there any better interrupt-oriented way to achieve this instead of polling?
-		  //maybe user-cliked cancel or other plugin aborts this plugin.
+      if (!(*it >= 0.0 && *it <= 100.0))
       {
-         std::string msg = getName() + " has been aborted."; //display message on the Progress tab and finalize. This is same as the previous modules.
-         pStep->finalize(Message::Abort, msg);
+         std::string msg = "Percentiles must be between 0 and 100 inclusive.";
+         pStep->finalize(Message::Failure, msg);
          if (pProgress != NULL)
          {
-            pProgress->updateProgress(msg, 0, ABORT);
+            pProgress->updateProgress(msg, 0, ERRORS);
          }
 
-         return false;
+         return NULL;
       }
+   }
+
+   pKernel->mpProgress = pProgress;
+   pKernel->mpCube = pCube;
+   pKernel->mPercentiles = percentiles;
 
-      if (!pAcc.isValid()) //if the accessed cube data is valid.
+   double noDataValue = 0.0;
+   bool hasNoDataValue = pInArgList->getPlugInArgValue("No Data Value", noDataValue);
+   pKernel->mBandMask = BadValueMask(pDesc, hasNoDataValue ? &noDataValue : NULL);
+
+   //An expression is evaluated by the workers a row at a time and its double values fed straight into the same
+   //statistics, so the bad values apply to the bands it reads and only NaN is left out of its results.
+   std::string expressionText;
+   pInArgList->getPlugInArgValue("Expression", expressionText);
+   pKernel->mMask = pKernel->mBandMask;
+   pKernel->mDataType = pDesc->getDataType();
+   if (!expressionText.empty())
+   {
+      std::string error;
+      if (!pKernel->mExpression.compile(expressionText, pDesc->getBandCount(), error))
       {
-         std::string msg = "Unable to access the cube data."; //same as previous
+         std::string msg = "The expression is not valid. " + error;
          pStep->finalize(Message::Failure, msg);
          if (pProgress != NULL)
          {
             pProgress->updateProgress(msg, 0, ERRORS);
          }
 
-         return false;
+         return NULL;
       }
+      pKernel->mpExpression = &pKernel->mExpression;
+      pKernel->mMask = BadValueMask(NULL);
+      pKernel->mMask.setRejectNan(true);
+      pKernel->mDataType = FLT8BYTES;
+      pStep->addProperty("Expression", expressionText);
+   }
+
+   //The strip readers, with their accessors, are created here on the plug-in's thread, and compute() only reads
+   //through them.
+   unsigned int readAheadRows = 0;
+   unsigned int readAheadDepth = 0;
+   unsigned int threadCount = 0;
+   RowReader::getReadAheadArgs(pInArgList, readAheadRows, readAheadDepth);
+   pInArgList->getPlugInArgValue("Thread Count", threadCount);
+   std::vector<unsigned int> strips = RowStripWorker::splitRows(pDesc->getRowCount(),
+      RowStripWorker::getThreadCount(pDesc->getRowCount(), threadCount));
+   std::vector<unsigned int> bands(1, 0); //the bands the expression uses, or just the first band
+   if (pKernel->mpExpression != NULL)
+   {
+      bands = pKernel->mpExpression->getBands();
+   }
+   pKernel->mpReaders.reset(new RowStripReaders(pCube, strips, bands, readAheadRows, readAheadDepth));
 
+   return pKernel.release();
+}
 
-	  //everything is OK. now, continue with the core logic of the plugin.
+bool Tutorial3::finishBatch(BatchKernel* pKernel, PlugInArgList* pOutArgList)
+{
+   StatisticsKernel* pStatistics = dynamic_cast<StatisticsKernel*>(pKernel);
+   if (pStatistics == NULL || pOutArgList == NULL) //the step is failed when the kernel is destroyed
+   {
+      return false;
+   }
+   DeferredStep* pStep = pStatistics->mStep.get();
+   Progress* pProgress = pStatistics->mpProgress;
+   if (!pStatistics->mComputed)
+   {
+      bool aborted = pStatistics->mFailure.empty();
+      std::string msg = aborted ? getName() + " has been aborted." : pStatistics->mFailure;
+      pStep->finalize(aborted ? Message::Abort : Message::Failure, msg);
       if (pProgress != NULL)
       {
-         pProgress->updateProgress("Calculating statistics", row * 100 / pDesc->getRowCount(), NORMAL); 
-		 //pointToNote - the progress is based on the number of rows already processed. NOT the total number of pixels processed.
-		 //continuosly get the percentage of rows processed and keep updating the progress bar.
+         pProgress->updateProgress(msg, 0, aborted ? ABORT : ERRORS);
       }
 
-	  //process columnwise
-      for (unsigned int col = 0; col < pDesc->getColumnCount(); ++col)
-      {
-		  //casts the column data obtained into the a type specified by the first arg.
-		  //switchOnEncoding semantcis: tpye, var_args(functor, data, values to operate on)
-		  //updateStatistics will update the min, max and the total. DOUBT: shouldnt we pass a reference or a pointer to this function?
-         switchOnEncoding(pDesc->getDataType(), updateStatistics, pAcc->getColumn(), min, max, total);
-         pAcc->nextColumn(); //make the internal pointer to proceed to the next column. next time the function pAcc->getColumn() is called, the value from the next column data is returned. similar logic for rows.
-      }
-      pAcc->nextRow();
+      return false;
    }
-   unsigned int count = pDesc->getColumnCount() * pDesc->getRowCount(); //total number of pixels.
-   double mean = total / count;
+
+   double min = pStatistics->mMin;
+   double max = pStatistics->mMax;
+   unsigned int count = pStatistics->mCount;
+   const std::vector<double>& percentiles = pStatistics->mPercentiles;
+   std::vector<double> percentileValues = pStatistics->mPercentileValues;
+   double mean = pStatistics->mTotal / count;
+   double median = percentileValues.back();
+   percentileValues.pop_back();
 
    if (pProgress != NULL)
    {
       std::string msg = "Minimum value: " + StringUtilities::toDisplayString(min) + "\n"
                       + "Maximum value: " + StringUtilities::toDisplayString(max) + "\n"
-                      + "Number of pixels: " + StringUtilities::toDisplayString(count) + "\n"
-                      + "Average: " + StringUtilities::toDisplayString(mean);
+                      + "Number of valid pixels: " + StringUtilities::toDisplayString(count) + "\n"
+                      + "Average: " + StringUtilities::toDisplayString(mean) + "\n"
+                      + "Median: " + StringUtilities::toDisplayString(median);
+      for (unsigned int i = 0; i < percentiles.size(); ++i)
+      {
+         msg += "\n" + StringUtilities::toDisplayString(percentiles[i]) + " percentile: "
+            + StringUtilities::toDisplayString(percentileValues[i]);
+      }
       pProgress->updateProgress(msg, 100, NORMAL);
    }
 
@@ -181,12 +811,24 @@ bool Tutorial3::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
    pStep->addProperty("Maximum", max);
    pStep->addProperty("Count", count);
    pStep->addProperty("Mean", mean);
+   pStep->addProperty("Median", median);
    
    pOutArgList->setPlugInArgValue("Minimum", &min);
    pOutArgList->setPlugInArgValue("Maximum", &max);
    pOutArgList->setPlugInArgValue("Count", &count);
    pOutArgList->setPlugInArgValue("Mean", &mean);
+   pOutArgList->setPlugInArgValue("Median", &median);
+   pOutArgList->setPlugInArgValue("Percentile Values", &percentileValues);
+   pOutArgList->setPlugInArgValue("Histogram", &pStatistics->mHistogram);
+   pOutArgList->setPlugInArgValue("Histogram Minimum", &pStatistics->mHistogramMinimum);
+   pOutArgList->setPlugInArgValue("Histogram Bin Width", &pStatistics->mHistogramBinWidth);
 
    pStep->finalize();
    return true;
 }
+
+bool Tutorial3::abort()
+{
+   mAborted = 1;
+   return ExecutableShell::abort();
+}
\ No newline at end of file
@@ -10,9 +10,11 @@
 #ifndef TUTORIAL3_H
 #define TUTORIAL3_H
 
+#include "BatchKernel.h"
 #include "ExecutableShell.h"
+#include <QtCore/QAtomicInt>
 
-class Tutorial3 : public ExecutableShell
+class Tutorial3 : public ExecutableShell, public BatchOperation
 {
 public:
    Tutorial3();
@@ -21,6 +23,13 @@ public:
    virtual bool getInputSpecification(PlugInArgList*& pInArgList);
    virtual bool getOutputSpecification(PlugInArgList*& pOutArgList);
    virtual bool execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList);
+   virtual bool abort();
+
+   virtual BatchKernel* prepareBatch(PlugInArgList* pInArgList);
+   virtual bool finishBatch(BatchKernel* pKernel, PlugInArgList* pOutArgList);
+
+private:
+   QAtomicInt mAborted;
 };
 
 #endif
\ No newline at end of file
@@ -7,14 +7,16 @@
  * http://www.gnu.org/licenses/lgpl.html
  */
 
+#include "AoiCover.h"
 #include "AoiElement.h"
+#include "AoiStatistics.h"
 #include "AppConfig.h"
 #include "AppVerify.h"
+#include "BadValueMask.h"
+#include "BatchKernel.h"
 #include "BitMask.h"
-#include "DataAccessor.h"
-#include "DataAccessorImpl.h"
-#include "DataRequest.h"
 #include "DesktopServices.h"
+#include "IntegerStatistics.h"
 #include "MessageLogResource.h"
 #include "ModelServices.h"
 #include "ObjectResource.h"
@@ -25,11 +27,16 @@
 #include "Progress.h"
 #include "RasterDataDescriptor.h"
 #include "RasterElement.h"
+#include "RowReader.h"
+#include "Slot.h"
+#include "StepLog.h"
 #include "StringUtilities.h"
 #include "switchOnEncoding.h"
 #include "Test4.h"
 #include "TypeConverter.h"
 #include <limits>
+#include <map>
+#include <memory>
 #include <vector>
 #include <QtCore/QStringList>
 #include <QtGui/QInputDialog>
@@ -40,16 +47,152 @@ REGISTER_PLUGIN_BASIC(OpticksTutorial, Tutorial4); //same as tutorial 3
 
 namespace //same comments as tutorial 3
 {
+   //processes one row of the request. A pixel counts if it is inside the AOI and not a bad value; the bad value test
+   //is blended in rather than branched on. 8 and 16 bit integers are compared and summed in their own type, over
+   //the row's AOI pixels marked in selected.
    template<typename T>
-   void updateStatistics(T* pData, double& min, double& max, double& total)
+   void updateStatistics(T* pData, unsigned int row, unsigned int startColumn, unsigned int endColumn,
+      const BitMask* pPoints, const BadValueMask& mask, std::vector<unsigned char>& selected, double& min, double& max,
+      double& total, unsigned int& count)
    {
-      min = std::min(min, static_cast<double>(*pData));
-      max = std::max(max, static_cast<double>(*pData));
-      total += *pData;
+      if (IntegerStatistics<T>::sSupported)
+      {
+         if (pPoints != NULL)
+         {
+            selected.resize(endColumn - startColumn + 1);
+            for (unsigned int col = startColumn; col <= endColumn; ++col)
+            {
+               selected[col - startColumn] = pPoints->getPixel(col, row);
+            }
+         }
+         IntegerStatistics<T>::addRow(pData, endColumn - startColumn + 1, mask.getIntegerValues(),
+            (pPoints == NULL) ? NULL : &selected.front(), NULL, min, max, total, count);
+         return;
+      }
+
+      for (unsigned int col = startColumn; col <= endColumn; ++col, ++pData)
+      {
+         if (pPoints == NULL || pPoints->getPixel(col, row))
+         {
+            double value = static_cast<double>(*pData);
+            bool valid = mask.isValid(value);
+            min = std::min(min, valid ? value : std::numeric_limits<double>::max());
+            max = std::max(max, valid ? value : -std::numeric_limits<double>::max());
+            total += valid ? value : 0.0;
+            count += valid;
+         }
+      }
+   }
+
+   //the plug-in keeping live statistics of each AOI, so a later live run on the same AOI replaces it
+   std::map<AoiElement*, Tutorial4*> sLiveRuns;
+
+   //One run of Tutorial 4, from its checked inputs to its results. compute() only reads the cube through the
+   //RowReaders prepareBatch() created, and leaves the step, the outputs and live mode to finishBatch().
+   class AoiKernel : public BatchKernel
+   {
+   public:
+      AoiKernel() :
+         mStep("Tutorial 4", "app", "95034AC8-EC4C-4CB6-9089-4EF0DCBB41C3"),
+         mpProgress(NULL),
+         mpCube(NULL),
+         mpAoi(NULL),
+         mpPoints(NULL),
+         mMask(NULL),
+         mLive(false),
+         mComputed(false),
+         mMin(std::numeric_limits<double>::max()),
+         mMax(-std::numeric_limits<double>::max()),
+         mTotal(0.0),
+         mCount(0),
+         mPixelsRead(0)
+      {
+      }
+
+      ~AoiKernel()
+      {
+         for (std::vector<RowReader*>::iterator it = mReaders.begin(); it != mReaders.end(); ++it)
+         {
+            delete *it;
+         }
+      }
+
+      virtual bool compute(QAtomicInt& aborted);
+
+      DeferredStepResource mStep;
+      Progress* mpProgress;
+      RasterElement* mpCube;
+      AoiElement* mpAoi;
+      const BitMask* mpPoints;
+      BadValueMask mMask;
+      bool mLive;
+      std::vector<AoiCover::Rectangle> mRectangles;
+      std::vector<RowReader*> mReaders; //one for each rectangle
+
+      bool mComputed;
+      std::string mFailure; //why compute() failed, empty if it was aborted
+      double mMin;
+      double mMax;
+      double mTotal;
+      unsigned int mCount;
+      unsigned long long mPixelsRead;
+   };
+
+   bool AoiKernel::compute(QAtomicInt& aborted)
+   {
+      //live mode has its statistics from AoiStatistics already
+      if (mLive)
+      {
+         mComputed = true;
+         return true;
+      }
+
+      const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(mpCube->getDataDescriptor());
+      unsigned long long totalRows = 0;
+      for (std::vector<AoiCover::Rectangle>::const_iterator it = mRectangles.begin(); it != mRectangles.end(); ++it)
+      {
+         totalRows += it->mEndRow - it->mStartRow + 1;
+         mPixelsRead += AoiCover::getArea(*it);
+      }
+
+      unsigned long long rowsDone = 0;
+      std::vector<unsigned char> selected;
+      for (unsigned int rectangle = 0; rectangle < mRectangles.size(); ++rectangle)
+      {
+         const AoiCover::Rectangle& bounds = mRectangles[rectangle];
+         RowReader& reader = *mReaders[rectangle];
+         for (unsigned int row = bounds.mStartRow; row <= bounds.mEndRow; ++row, ++rowsDone)
+         {
+            if (aborted != 0)
+            {
+               return false;
+            }
+            if (!reader.isValid())
+            {
+               mFailure = "Unable to access the cube data.";
+               return false;
+            }
+
+            if (mpProgress != NULL)
+            {
+               mpProgress->updateProgress("Calculating statistics", static_cast<int>(rowsDone * 100 / totalRows), NORMAL);
+            }
+
+            switchOnEncoding(pDesc->getDataType(), updateStatistics, reader.getRow(), row, bounds.mStartColumn,
+               bounds.mEndColumn, mpPoints, mMask, selected, mMin, mMax, mTotal, mCount);
+            reader.nextRow();
+         }
+      }
+
+      mComputed = true;
+      return true;
    }
 };
 
-Tutorial4::Tutorial4() //same as tutorial 1,2 and 3.
+Tutorial4::Tutorial4() : //same as tutorial 1,2 and 3.
+   mpLiveStatistics(NULL),
+   mKeptForLive(false),
+   mAborted(0)
 {
    setDescriptorId("{F58F8F9A-6D2D-4EB1-9FD8-FD6D2E6ECB49}");
    setName("Tutorial 4");
@@ -62,10 +205,16 @@ Tutorial4::Tutorial4() //same as tutorial 1,2 and 3.
    setSubtype("Statistics");
    setMenuLocation("[Tutorial]/Tutorial 4");
    setAbortSupported(true);
+
+   mpLiveAoi.addSignal(SIGNAL_NAME(Subject, Modified), Slot(this, &Tutorial4::aoiModified));
+   mpLiveAoi.addSignal(SIGNAL_NAME(Subject, Deleted), Slot(this, &Tutorial4::elementDeleted));
+   mpLiveCube.addSignal(SIGNAL_NAME(Subject, Deleted), Slot(this, &Tutorial4::elementDeleted));
 }
 
 Tutorial4::~Tutorial4() //same as always ;)
 {
+   mKeptForLive = false; //already being destroyed
+   stopLive();
 }
 
 bool Tutorial4::getInputSpecification(PlugInArgList*& pInArgList) //similar to tutorial 3, except for a small tweak - adding area 
@@ -77,6 +226,11 @@ bool Tutorial4::getInputSpecification(PlugInArgList*& pInArgList) //similar to t
    {
       pInArgList->addArg<AoiElement>("AOI", NULL, "The AOI to calculate statistics over"); //input argument type is being specified as AoiElement. syntax: name, ??, description
    }
+   pInArgList->addArg<double>("No Data Value", "Pixels with this value are excluded, along with the bad values of the raster element");
+   pInArgList->addArg<bool>("Live", false, "Keep the plug-in running after this execution and show updated "
+      "statistics in the status bar each time the AOI is edited. Asked for when an AOI is selected from the menu. "
+      "A later live run on the same AOI replaces this one.");
+   RowReader::addReadAheadArgs(pInArgList);
    return true;
 }
 
@@ -85,19 +239,37 @@ bool Tutorial4::getOutputSpecification(PlugInArgList*& pOutArgList) //same as #3
    VERIFY(pOutArgList = Service<PlugInManagerServices>()->getPlugInArgList());
    pOutArgList->addArg<double>("Minimum", "The minimum value");
    pOutArgList->addArg<double>("Maximum", "The maximum value");
-   pOutArgList->addArg<unsigned int>("Count", "The number of pixels");
+   pOutArgList->addArg<unsigned int>("Count", "The number of valid pixels");
    pOutArgList->addArg<double>("Mean", "The average value");
    return true;
 }
 
 bool Tutorial4::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
 {
-   StepResource pStep("Tutorial 4", "app", "95034AC8-EC4C-4CB6-9089-4EF0DCBB41C3"); //same as #3
-   if (pInArgList == NULL || pOutArgList == NULL) //same as #3
+   //The run is split so that Tutorial 7 can do the calculation on its own threads, see BatchKernel.h.
+   std::auto_ptr<BatchKernel> pKernel(prepareBatch(pInArgList));
+   if (pKernel.get() == NULL)
    {
       return false;
    }
+   pKernel->compute(mAborted);
+   return finishBatch(pKernel.get(), pOutArgList);
+}
+
+BatchKernel* Tutorial4::prepareBatch(PlugInArgList* pInArgList)
+{
+   std::auto_ptr<AoiKernel> pKernel(new AoiKernel);
+   DeferredStep* pStep = pKernel->mStep.get(); //same as #3
+   if (pInArgList == NULL) //same as #3
+   {
+      return NULL;
+   }
    Progress* pProgress = pInArgList->getPlugInArgValue<Progress>(Executable::ProgressArg()); //same as #3
+
+   //running again ends any live statistics from the last run, and whoever runs the plug-in now destroys it
+   mKeptForLive = false;
+   destroyAfterExecute(true);
+   stopLive();
    RasterElement* pCube = pInArgList->getPlugInArgValue<RasterElement>(Executable::DataElementArg());
    if (pCube == NULL)
    {
@@ -108,11 +280,11 @@ bool Tutorial4::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
          pProgress->updateProgress(msg, 0, ERRORS);
       }
 
-      return false;
+      return NULL;
    }
 
    RasterDataDescriptor* pDesc = static_cast<RasterDataDescriptor*>(pCube->getDataDescriptor());
-   VERIFY(pDesc != NULL);
+   VERIFYRV(pDesc != NULL, NULL);
 
    AoiElement* pAoi = NULL; //define a pointer to an Aoi object.
    if (isBatch()) //tells whether the execution is happeneing in batch mode. (But what exactly is a batch mode?)
@@ -154,7 +326,7 @@ bool Tutorial4::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
                   pProgress->updateProgress(msg, 0, ERRORS);
                }
 
-               return false;
+               return NULL;
             }
          }
       }
@@ -185,30 +357,35 @@ bool Tutorial4::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
       endColumn = x2;
    }
 
-   FactoryResource<DataRequest> pRequest; //same as #3. refer to comments from tutorial 3
-   pRequest->setRows(pDesc->getActiveRow(startRow), pDesc->getActiveRow(endRow));
-   pRequest->setColumns(pDesc->getActiveColumn(startColumn), pDesc->getActiveColumn(endColumn));
-   pRequest->setInterleaveFormat(BSQ);
-   DataAccessor pAcc = pCube->getDataAccessor(pRequest.release());
-   double min = std::numeric_limits<double>::max();
-   double max = -min;
-   double total = 0.0;
-   unsigned int count = 0;
-   for (unsigned int row = startRow; row <= endRow; ++row)
+   double noDataValue = 0.0;
+   bool hasNoDataValue = pInArgList->getPlugInArgValue("No Data Value", noDataValue);
+   BadValueMask mask(pDesc, hasNoDataValue ? &noDataValue : NULL);
+
+   //Live mode keeps the statistics as span lists it can update when the AOI changes, so it calculates them that way
+   //from the start instead of with the kernel's row loop.
+   bool live = false;
+   pInArgList->getPlugInArgValue("Live", live);
+   if (!isBatch() && pAoi != NULL && !live)
    {
-      if (isAborted())
+      QStringList modes("Once");
+      modes << "Live";
+      bool selected = false;
+      QString mode = QInputDialog::getItem(Service<DesktopServices>()->getMainWidget(), "Select the statistics mode",
+         "Calculate the statistics once, or keep them updated in the status bar as the AOI is edited", modes, 0, false,
+         &selected);
+      live = selected && mode == "Live";
+   }
+   live = live && pAoi != NULL;
+   if (live)
+   {
+      mpLiveStatistics = new AoiStatistics(pCube, mask);
+      if (pProgress != NULL)
       {
-         std::string msg = getName() + " has been aborted.";
-         pStep->finalize(Message::Abort, msg);
-         if (pProgress != NULL)
-         {
-            pProgress->updateProgress(msg, 0, ABORT);
-         }
-
-         return false;
+         pProgress->updateProgress("Calculating statistics", 0, NORMAL);
       }
-      if (!pAcc.isValid())
+      if (!mpLiveStatistics->update(pPoints))
       {
+         stopLive();
          std::string msg = "Unable to access the cube data.";
          pStep->finalize(Message::Failure, msg);
          if (pProgress != NULL)
@@ -216,24 +393,80 @@ bool Tutorial4::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
             pProgress->updateProgress(msg, 0, ERRORS);
          }
 
-         return false;
+         return NULL;
       }
+   }
+
+   pKernel->mpProgress = pProgress;
+   pKernel->mpCube = pCube;
+   pKernel->mpAoi = pAoi;
+   pKernel->mpPoints = pPoints;
+   pKernel->mMask = mask;
+   pKernel->mLive = live;
+   if (live)
+   {
+      pKernel->mMin = mpLiveStatistics->getMinimum();
+      pKernel->mMax = mpLiveStatistics->getMaximum();
+      pKernel->mTotal = mpLiveStatistics->getMean() * mpLiveStatistics->getCount();
+      pKernel->mCount = mpLiveStatistics->getCount();
+      return pKernel.release();
+   }
+
+   //An AOI of a few distant shapes would read mostly unselected pixels through its bounding box, so it is read as
+   //the few rectangles which cover its selected pixels instead, one DataRequest each. The readers are created here
+   //on the plug-in's thread and each only starts reading ahead once compute() gets to its rectangle.
+   unsigned int readAheadRows = 0;
+   unsigned int readAheadDepth = 0;
+   RowReader::getReadAheadArgs(pInArgList, readAheadRows, readAheadDepth);
+   pKernel->mRectangles = AoiCover::getRectangles(pPoints, startRow, endRow, startColumn, endColumn);
+   for (std::vector<AoiCover::Rectangle>::const_iterator it = pKernel->mRectangles.begin();
+      it != pKernel->mRectangles.end(); ++it)
+   {
+      pKernel->mReaders.push_back(new RowReader(pCube, it->mStartRow, it->mEndRow, it->mStartColumn, it->mEndColumn,
+         readAheadRows, readAheadDepth)); //reads the same rows and columns a DataRequest for the rectangle would.
+   }
+   return pKernel.release();
+}
 
+bool Tutorial4::finishBatch(BatchKernel* pKernel, PlugInArgList* pOutArgList)
+{
+   AoiKernel* pAoiKernel = dynamic_cast<AoiKernel*>(pKernel);
+   if (pAoiKernel == NULL || pOutArgList == NULL) //the step is failed when the kernel is destroyed
+   {
+      stopLive();
+      return false;
+   }
+   DeferredStep* pStep = pAoiKernel->mStep.get();
+   Progress* pProgress = pAoiKernel->mpProgress;
+   if (!pAoiKernel->mComputed)
+   {
+      bool aborted = pAoiKernel->mFailure.empty();
+      std::string msg = aborted ? getName() + " has been aborted." : pAoiKernel->mFailure;
+      pStep->finalize(aborted ? Message::Abort : Message::Failure, msg);
       if (pProgress != NULL)
       {
-         pProgress->updateProgress("Calculating statistics", row * 100 / pDesc->getRowCount(), NORMAL);
+         pProgress->updateProgress(msg, 0, aborted ? ABORT : ERRORS);
       }
 
-      for (unsigned int col = startColumn; col <= endColumn; ++col)
+      return false;
+   }
+
+   bool live = pAoiKernel->mLive;
+   double min = pAoiKernel->mMin;
+   double max = pAoiKernel->mMax;
+   double total = pAoiKernel->mTotal;
+   unsigned int count = pAoiKernel->mCount;
+   if (count == 0)
+   {
+      stopLive();
+      std::string msg = "The AOI has no valid pixels.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
       {
-         if (pPoints == NULL || pPoints->getPixel(col, row))
-         {
-            switchOnEncoding(pDesc->getDataType(), updateStatistics, pAcc->getColumn(), min, max, total);
-            ++count;
-            pAcc->nextColumn();
-         }
+         pProgress->updateProgress(msg, 0, ERRORS);
       }
-      pAcc->nextRow();
+
+      return false;
    }
    double mean = total / count;
 
@@ -241,7 +474,7 @@ bool Tutorial4::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
    {
       std::string msg = "Minimum value: " + StringUtilities::toDisplayString(min) + "\n"
                       + "Maximum value: " + StringUtilities::toDisplayString(max) + "\n"
-                      + "Number of pixels: " + StringUtilities::toDisplayString(count) + "\n"
+                      + "Number of valid pixels: " + StringUtilities::toDisplayString(count) + "\n"
                       + "Average: " + StringUtilities::toDisplayString(mean);
       pProgress->updateProgress(msg, 100, NORMAL);
    }
@@ -255,6 +488,90 @@ bool Tutorial4::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
    pOutArgList->setPlugInArgValue("Count", &count);
    pOutArgList->setPlugInArgValue("Mean", &mean);
 
+   if (live)
+   {
+      //the plug-in has to outlive this execution to keep receiving the AOI's changes, so stopLive() destroys it
+      std::map<AoiElement*, Tutorial4*>::iterator previous = sLiveRuns.find(pAoiKernel->mpAoi);
+      if (previous != sLiveRuns.end() && previous->second != this)
+      {
+         previous->second->stopLive();
+      }
+      sLiveRuns[pAoiKernel->mpAoi] = this;
+      mpLiveAoi.reset(pAoiKernel->mpAoi);
+      mpLiveCube.reset(pAoiKernel->mpCube);
+      destroyAfterExecute(false);
+      mKeptForLive = true;
+   }
+   pStep->addProperty("Live", live);
+   if (!live)
+   {
+      pStep->addProperty("Rectangles", static_cast<unsigned int>(pAoiKernel->mRectangles.size()));
+      pStep->addProperty("Pixels Read", pAoiKernel->mPixelsRead);
+   }
+
    pStep->finalize(); //DO NOT forget to finalize!
    return true;
+}
+
+void Tutorial4::aoiModified(Subject& subject, const std::string& signal, const boost::any& value)
+{
+   AoiElement* pAoi = mpLiveAoi.get();
+   if (pAoi == NULL || mpLiveStatistics == NULL)
+   {
+      return;
+   }
+
+   std::string msg;
+   if (!mpLiveStatistics->update(pAoi->getSelectedPoints()))
+   {
+      stopLive();
+      msg = "Unable to access the cube data. Live statistics have stopped.";
+   }
+   else if (mpLiveStatistics->getCount() == 0)
+   {
+      msg = pAoi->getName() + " has no valid pixels.";
+   }
+   else
+   {
+      msg = pAoi->getName() + " - Minimum: " + StringUtilities::toDisplayString(mpLiveStatistics->getMinimum()) +
+         ", Maximum: " + StringUtilities::toDisplayString(mpLiveStatistics->getMaximum()) +
+         ", Count: " + StringUtilities::toDisplayString(mpLiveStatistics->getCount()) +
+         ", Mean: " + StringUtilities::toDisplayString(mpLiveStatistics->getMean()) +
+         ", Standard Deviation: " + StringUtilities::toDisplayString(mpLiveStatistics->getStandardDeviation());
+   }
+   Service<DesktopServices>()->setStatusBarMessage(msg);
+}
+
+void Tutorial4::elementDeleted(Subject& subject, const std::string& signal, const boost::any& value)
+{
+   stopLive();
+}
+
+void Tutorial4::stopLive()
+{
+   //by value, as the AOI may already be gone
+   for (std::map<AoiElement*, Tutorial4*>::iterator it = sLiveRuns.begin(); it != sLiveRuns.end(); ++it)
+   {
+      if (it->second == this)
+      {
+         sLiveRuns.erase(it);
+         break;
+      }
+   }
+   mpLiveAoi.reset(NULL);
+   mpLiveCube.reset(NULL);
+   delete mpLiveStatistics;
+   mpLiveStatistics = NULL;
+   if (mKeptForLive)
+   {
+      //nothing else destroys a plug-in kept after its execution, and this must be the last use of it
+      mKeptForLive = false;
+      Service<PlugInManagerServices>()->destroyPlugIn(this);
+   }
+}
+
+bool Tutorial4::abort()
+{
+   mAborted = 1;
+   return ExecutableShell::abort();
 }
\ No newline at end of file
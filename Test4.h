@@ -10,9 +10,19 @@
 #ifndef TUTORIAL4_H
 #define TUTORIAL4_H
 
+#include "AoiElement.h"
+#include "AttachmentPtr.h"
+#include "BatchKernel.h"
 #include "ExecutableShell.h"
+#include "RasterElement.h"
+#include <boost/any.hpp>
+#include <QtCore/QAtomicInt>
+#include <string>
 
-class Tutorial4 : public ExecutableShell
+class AoiStatistics;
+class Subject;
+
+class Tutorial4 : public ExecutableShell, public BatchOperation
 {
 public:
    Tutorial4();
@@ -21,6 +31,21 @@ public:
    virtual bool getInputSpecification(PlugInArgList*& pInArgList);
    virtual bool getOutputSpecification(PlugInArgList*& pOutArgList);
    virtual bool execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList);
+   virtual bool abort();
+
+   virtual BatchKernel* prepareBatch(PlugInArgList* pInArgList);
+   virtual bool finishBatch(BatchKernel* pKernel, PlugInArgList* pOutArgList);
+
+private:
+   void aoiModified(Subject& subject, const std::string& signal, const boost::any& value);
+   void elementDeleted(Subject& subject, const std::string& signal, const boost::any& value);
+   void stopLive();
+
+   AttachmentPtr<AoiElement> mpLiveAoi;
+   AttachmentPtr<RasterElement> mpLiveCube;
+   AoiStatistics* mpLiveStatistics;
+   bool mKeptForLive; //destroyAfterExecute(false) was called, so stopLive() destroys the plug-in
+   QAtomicInt mAborted;
 };
 
 #endif
@@ -7,11 +7,15 @@
  * http://www.gnu.org/licenses/lgpl.html
  */
 
+#include "AppVerify.h"
+#include "BadValueMask.h"
+#include "BatchKernel.h"
 #include "DataAccessor.h"
 #include "DataAccessorImpl.h"
 #include "DataRequest.h"
 #include "DesktopServices.h"
 #include "MessageLogResource.h"
+#include "ModelServices.h"
 #include "ObjectResource.h"
 #include "PlugInArgList.h"
 #include "PlugInManagerServices.h"
@@ -20,80 +24,836 @@
 #include "RasterDataDescriptor.h"
 #include "RasterElement.h"
 #include "RasterUtilities.h"
+#include "RowReader.h"
+#include "RowWriter.h"
 #include "SpatialDataView.h"
 #include "SpatialDataWindow.h"
+#include "StepLog.h"
+#include "StringUtilities.h"
 #include "switchOnEncoding.h"
 #include "Test5.h"
+#include "Test6.h"
+#include "TypeConverter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
 
 REGISTER_PLUGIN_BASIC(OpticksTutorial, Tutorial5); //didnt understand this..
 
 namespace
 {
+   //rows labeled by each of the Canny edge linker's union-finds before its components join the equivalence table
+   const unsigned int sLinkStripRows = 64;
+
+   //One source row, converted to double and padded by a copy of the edge pixel on each side so the kernel needs no
+   //bounds checks. mValid marks the samples which are not bad values.
+   struct SourceRow
+   {
+      std::vector<double> mValues;
+      std::vector<unsigned char> mValid;
+   };
+
    template<typename T>
-   void edgeDetection(T* pData, DataAccessor pSrcAcc, int row, int col, int rowSize, int colSize) //templated function. reason: switchOnEncoding can be set to its type. It introduces more flexibility into the code.
-   {
-		//This function is applied for a particular pixel.
-	   //data accessor objects do not check for bounds while processing. Hence, they may throw exceptions. The next set of statements provide the bounds for 
-      int prevCol = std::max(col - 1, 0);
-      int prevRow = std::max(row - 1, 0);
-      int nextCol = std::min(col + 1, colSize - 1);
-      int nextRow = std::min(row + 1, rowSize - 1);
-      
-	  //access the pixel values at ALL the positions in the window.
-	  //The values are stored in pSrcAcc in an internal data structure. Am I right?
-	  //If so, the method getColumn() extracts and delivers the value, in the third statement.
-	  //ensure that the pixel value read is valid. (how? bounds of 0-255 on an 8-bit image?)
-
-      pSrcAcc->toPixel(prevRow, prevCol);
-      VERIFYNRV(pSrcAcc.isValid());
-      T upperLeftVal = *reinterpret_cast<T*>(pSrcAcc->getColumn());
-
-      pSrcAcc->toPixel(prevRow, col);
-      VERIFYNRV(pSrcAcc.isValid());
-      T upVal = *reinterpret_cast<T*>(pSrcAcc->getColumn());
-
-      pSrcAcc->toPixel(prevRow, nextCol);
-      VERIFYNRV(pSrcAcc.isValid());
-      T upperRightVal = *reinterpret_cast<T*>(pSrcAcc->getColumn());
-
-      pSrcAcc->toPixel(row, prevCol);
-      VERIFYNRV(pSrcAcc.isValid());
-      T leftVal = *reinterpret_cast<T*>(pSrcAcc->getColumn());
-
-      pSrcAcc->toPixel(row, nextCol);
-      VERIFYNRV(pSrcAcc.isValid());
-      T rightVal = *reinterpret_cast<T*>(pSrcAcc->getColumn());
-
-      pSrcAcc->toPixel(nextRow, prevCol);
-      VERIFYNRV(pSrcAcc.isValid());
-      T lowerLeftVal = *reinterpret_cast<T*>(pSrcAcc->getColumn());
-
-      pSrcAcc->toPixel(nextRow, col);
-      VERIFYNRV(pSrcAcc.isValid());
-      T downVal = *reinterpret_cast<T*>(pSrcAcc->getColumn());
-
-      pSrcAcc->toPixel(nextRow, nextCol);
-      VERIFYNRV(pSrcAcc.isValid());
-      T lowerRightVal = *reinterpret_cast<T*>(pSrcAcc->getColumn());
-
-	  //calculate the weighted average along the y-axis / rows
-      double gx = -1.0 * upperLeftVal + -2.0 * leftVal + -1.0 * lowerLeftVal + 1.0 * upperRightVal + 2.0 *
+   void readRow(T* pData, unsigned int colSize, const BadValueMask& mask, SourceRow& row)
+   {
+      row.mValues.resize(colSize + 2);
+      row.mValid.resize(colSize + 2);
+      for (unsigned int col = 0; col < colSize; ++col)
+      {
+         double value = static_cast<double>(pData[col]);
+         row.mValues[col + 1] = value;
+         row.mValid[col + 1] = mask.isValid(value);
+      }
+      row.mValues[0] = row.mValues[1];
+      row.mValid[0] = row.mValid[1];
+      row.mValues[colSize + 1] = row.mValues[colSize];
+      row.mValid[colSize + 1] = row.mValid[colSize];
+   }
+
+   //reads the reader's next row into row, false if it has none or the read fails
+   bool readSourceRow(RowReader& reader, EncodingType type, unsigned int colSize, const BadValueMask& mask,
+      SourceRow& row)
+   {
+      void* pData = reader.isValid() ? reader.getRow() : NULL;
+      if (pData == NULL)
+      {
+         return false;
+      }
+      switchOnEncoding(type, readRow, pData, colSize, mask, row);
+      reader.nextRow();
+      return true;
+   }
+
+   //Applies the sobel operator at one column of a row, given the rows above and below it. Bad neighbors are blended
+   //to the center value so they add no gradient.
+   inline void sobel(const SourceRow& up, const SourceRow& center, const SourceRow& down, unsigned int col,
+      double& gx, double& gy)
+   {
+      double centerVal = center.mValues[col];
+      double upperLeftVal = up.mValid[col - 1] ? up.mValues[col - 1] : centerVal;
+      double upVal = up.mValid[col] ? up.mValues[col] : centerVal;
+      double upperRightVal = up.mValid[col + 1] ? up.mValues[col + 1] : centerVal;
+      double leftVal = center.mValid[col - 1] ? center.mValues[col - 1] : centerVal;
+      double rightVal = center.mValid[col + 1] ? center.mValues[col + 1] : centerVal;
+      double lowerLeftVal = down.mValid[col - 1] ? down.mValues[col - 1] : centerVal;
+      double downVal = down.mValid[col] ? down.mValues[col] : centerVal;
+      double lowerRightVal = down.mValid[col + 1] ? down.mValues[col + 1] : centerVal;
+
+      //calculate the weighted average along the y-axis / rows
+      gx = -1.0 * upperLeftVal + -2.0 * leftVal + -1.0 * lowerLeftVal + 1.0 * upperRightVal + 2.0 *
          rightVal + 1.0 * lowerRightVal;
 
-	  //calculate the weighted average along the x-axis / columns
-      double gy = -1.0 * lowerLeftVal + -2.0 * downVal + -1.0 * lowerRightVal + 1.0 * upperLeftVal + 2.0 *
+      //calculate the weighted average along the x-axis / columns
+      gy = -1.0 * lowerLeftVal + -2.0 * downVal + -1.0 * lowerRightVal + 1.0 * upperLeftVal + 2.0 *
          upVal + 1.0 * upperRightVal;
+   }
+
+   //Applies the sobel operator to a whole row, given the rows above and below it (the same row at the image edges).
+   //Bad centers give 0.
+   void edgeDetection(const SourceRow& up, const SourceRow& center, const SourceRow& down, unsigned int colSize,
+      std::vector<double>& magnitude)
+   {
+      magnitude.resize(colSize);
+      for (unsigned int col = 1; col <= colSize; ++col)
+      {
+         double gx = 0.0;
+         double gy = 0.0;
+         sobel(up, center, down, col, gx, gy);
+
+         //These two components are perpendicular to one another. Hence, magnitude of their vector addition leads to:
+         magnitude[col - 1] = center.mValid[col] ? sqrt(gx * gx + gy * gy) : 0.0;
+      }
+   }
+
+   //Canny mode streams the source through four stages, each holding only a few rows: gaussian smoothing, the sobel
+   //gradient, non-maximum suppression with the double threshold, and hysteresis linking of the thresholded rows.
+
+   //Gaussian smoothing of successive rows. Each source row is blurred horizontally as it is read and kept in a ring
+   //of 2 * radius + 1 rows for the vertical blur. Weights and weighted sums are blurred separately so bad samples
+   //drop out of the average instead of smearing into it.
+   class SmoothedRows
+   {
+   public:
+      SmoothedRows(RowReader& reader, EncodingType type, unsigned int colSize, unsigned int rowCount,
+         const BadValueMask& mask, double sigma) :
+         mReader(reader),
+         mType(type),
+         mColSize(colSize),
+         mRowCount(rowCount),
+         mMask(mask),
+         mRadius(sigma > 0.0 ? static_cast<unsigned int>(ceil(3.0 * sigma)) : 0),
+         mNextSourceRow(0),
+         mNextRow(0)
+      {
+         for (unsigned int offset = 0; offset <= mRadius; ++offset)
+         {
+            mKernel.push_back(sigma > 0.0 ? exp(-0.5 * offset * offset / (sigma * sigma)) : 1.0);
+         }
+         mRows.resize(std::min(2 * mRadius + 1, rowCount));
+      }
+
+      bool read(SourceRow& smoothed)
+      {
+         unsigned int row = mNextRow++;
+         for (; mNextSourceRow <= std::min(row + mRadius, mRowCount - 1); ++mNextSourceRow)
+         {
+            if (!readSource(mNextSourceRow))
+            {
+               return false;
+            }
+         }
+
+         //rows past the image edges repeat the edge row
+         const BlurredRow& center = mRows[row % mRows.size()];
+         smoothed.mValues.assign(mColSize + 2, 0.0);
+         smoothed.mValid.resize(mColSize + 2);
+         mSums.assign(mColSize, 0.0);
+         mWeights.assign(mColSize, 0.0);
+         for (int offset = -static_cast<int>(mRadius); offset <= static_cast<int>(mRadius); ++offset)
+         {
+            int sourceRow = std::max(0, std::min(static_cast<int>(row) + offset, static_cast<int>(mRowCount) - 1));
+            const BlurredRow& blurred = mRows[sourceRow % mRows.size()];
+            double weight = mKernel[abs(offset)];
+            for (unsigned int col = 0; col < mColSize; ++col)
+            {
+               mSums[col] += weight * blurred.mSums[col];
+               mWeights[col] += weight * blurred.mWeights[col];
+            }
+         }
+         for (unsigned int col = 0; col < mColSize; ++col)
+         {
+            smoothed.mValues[col + 1] = (mWeights[col] > 0.0) ? mSums[col] / mWeights[col] : 0.0;
+            smoothed.mValid[col + 1] = center.mValid[col];
+         }
+         smoothed.mValues[0] = smoothed.mValues[1];
+         smoothed.mValid[0] = smoothed.mValid[1];
+         smoothed.mValues[mColSize + 1] = smoothed.mValues[mColSize];
+         smoothed.mValid[mColSize + 1] = smoothed.mValid[mColSize];
+         return true;
+      }
+
+   private:
+      struct BlurredRow
+      {
+         std::vector<double> mSums;
+         std::vector<double> mWeights;
+         std::vector<unsigned char> mValid;
+      };
+
+      bool readSource(unsigned int row)
+      {
+         if (!readSourceRow(mReader, mType, mColSize, mMask, mSource))
+         {
+            return false;
+         }
+
+         BlurredRow& blurred = mRows[row % mRows.size()];
+         blurred.mSums.assign(mColSize, 0.0);
+         blurred.mWeights.assign(mColSize, 0.0);
+         blurred.mValid.assign(mSource.mValid.begin() + 1, mSource.mValid.end() - 1);
+         for (unsigned int col = 0; col < mColSize; ++col)
+         {
+            for (int offset = -static_cast<int>(mRadius); offset <= static_cast<int>(mRadius); ++offset)
+            {
+               int sourceCol = std::max(0, std::min(static_cast<int>(col) + offset, static_cast<int>(mColSize) - 1));
+               double weight = mSource.mValid[sourceCol + 1] ? mKernel[abs(offset)] : 0.0;
+               blurred.mSums[col] += mSource.mValid[sourceCol + 1] ? weight * mSource.mValues[sourceCol + 1] : 0.0;
+               blurred.mWeights[col] += weight;
+            }
+         }
+         return true;
+      }
+
+      RowReader& mReader;
+      EncodingType mType;
+      unsigned int mColSize;
+      unsigned int mRowCount;
+      const BadValueMask& mMask;
+      unsigned int mRadius;
+      std::vector<double> mKernel;
+      std::vector<BlurredRow> mRows;
+      SourceRow mSource;
+      std::vector<double> mSums;
+      std::vector<double> mWeights;
+      unsigned int mNextSourceRow;
+      unsigned int mNextRow;
+   };
+
+   //Gradient magnitude and direction of one row, padded by a zero on each side for non-maximum suppression. The
+   //direction is one of four sectors: 0 along the row, 1 up and to the right, 2 along the column, 3 down and to
+   //the right.
+   struct GradientRow
+   {
+      std::vector<double> mMagnitude;
+      std::vector<unsigned char> mSector;
+   };
+
+   //The sobel gradient of successive smoothed rows, through the same three row window as the plain edge detection.
+   class GradientRows
+   {
+   public:
+      GradientRows(SmoothedRows& source, unsigned int colSize, unsigned int rowCount) :
+         mSource(source),
+         mColSize(colSize),
+         mRowCount(rowCount),
+         mWindow(3),
+         mNextRow(0)
+      {
+      }
+
+      bool read(GradientRow& gradient)
+      {
+         unsigned int row = mNextRow++;
+         if (row == 0)
+         {
+            if (!mSource.read(mWindow[1]))
+            {
+               return false;
+            }
+            mWindow[0] = mWindow[1];
+            mWindow[2] = mWindow[1];
+            if (mRowCount > 1 && !mSource.read(mWindow[2]))
+            {
+               return false;
+            }
+         }
+         else
+         {
+            std::swap(mWindow[0], mWindow[1]);
+            std::swap(mWindow[1], mWindow[2]);
+            if (row + 1 < mRowCount)
+            {
+               if (!mSource.read(mWindow[2]))
+               {
+                  return false;
+               }
+            }
+            else
+            {
+               mWindow[2] = mWindow[1];
+            }
+         }
+
+         gradient.mMagnitude.assign(mColSize + 2, 0.0);
+         gradient.mSector.assign(mColSize + 2, 0);
+         for (unsigned int col = 1; col <= mColSize; ++col)
+         {
+            double gx = 0.0;
+            double gy = 0.0;
+            sobel(mWindow[0], mWindow[1], mWindow[2], col, gx, gy);
+            gradient.mMagnitude[col] = mWindow[1].mValid[col] ? sqrt(gx * gx + gy * gy) : 0.0;
+
+            //gy points up the image, so gx and gy of the same sign point up and to the right
+            double ax = fabs(gx);
+            double ay = fabs(gy);
+            if (ay <= 0.41421356 * ax) //tan(22.5)
+            {
+               gradient.mSector[col] = 0;
+            }
+            else if (ay >= 2.41421356 * ax) //tan(67.5)
+            {
+               gradient.mSector[col] = 2;
+            }
+            else
+            {
+               gradient.mSector[col] = (gx * gy > 0.0) ? 1 : 3;
+            }
+         }
+         return true;
+      }
+
+   private:
+      SmoothedRows& mSource;
+      unsigned int mColSize;
+      unsigned int mRowCount;
+      std::vector<SourceRow> mWindow;
+      unsigned int mNextRow;
+   };
+
+   //Non-maximum suppression and the double threshold of one gradient row, given the rows above and below it (zero
+   //rows at the image edges). Each pixel becomes 0 for no edge, 1 for a weak edge and 2 for a strong edge.
+   void suppressRow(const GradientRow& up, const GradientRow& center, const GradientRow& down, double lowThreshold,
+      double highThreshold, unsigned char* pClasses)
+   {
+      unsigned int colSize = center.mMagnitude.size() - 2;
+      for (unsigned int col = 1; col <= colSize; ++col)
+      {
+         double magnitude = center.mMagnitude[col];
+         double before = 0.0;
+         double after = 0.0;
+         switch (center.mSector[col])
+         {
+         case 0:
+            before = center.mMagnitude[col - 1];
+            after = center.mMagnitude[col + 1];
+            break;
+         case 1:
+            before = down.mMagnitude[col - 1];
+            after = up.mMagnitude[col + 1];
+            break;
+         case 2:
+            before = down.mMagnitude[col];
+            after = up.mMagnitude[col];
+            break;
+         default:
+            before = up.mMagnitude[col - 1];
+            after = down.mMagnitude[col + 1];
+            break;
+         }
+
+         //ties along a flat ridge keep the pixel on the "after" side only, so the edge stays one pixel wide
+         bool maximum = magnitude > before && magnitude >= after;
+         pClasses[col - 1] = !maximum ? 0 : (magnitude >= highThreshold ? 2 : (magnitude >= lowThreshold ? 1 : 0));
+      }
+   }
+
+   //Hysteresis linking by connected components of runs. The rows are labeled in strips: each run of weak or
+   //strong pixels in a row is a node of the strip's own union-find, joined to the 8-connected runs of the row
+   //before it. When a strip is finished its components are compacted into an equivalence table for the whole
+   //image, which records whether each holds a strong pixel, and the runs of its first row are merged there with
+   //the touching runs of the last row of the strip above. Only one label per run is kept, not per pixel, and
+   //once every row is labeled a single pass replaces the classes with the edge mask: a run is an edge when its
+   //component holds a strong pixel.
+   class EdgeLinker
+   {
+   public:
+      EdgeLinker(unsigned int stripRows) :
+         mStripRows(std::max(stripRows, 1u)),
+         mRowInStrip(0),
+         mNextRun(0)
+      {
+      }
+
+      //labels the next row's runs, from the first row down
+      void addRow(const unsigned char* pClasses, unsigned int colSize)
+      {
+         findRuns(pClasses, colSize, mCurrent);
+         std::vector<EdgeRun>::const_iterator previous = mPrevious.begin();
+         for (std::vector<EdgeRun>::iterator run = mCurrent.begin(); run != mCurrent.end(); ++run)
+         {
+            run->mLabel = mStripParents.size();
+            mStripParents.push_back(run->mLabel);
+            mStripStrong.push_back(run->mStrong);
+            mStripLabels.push_back(run->mLabel);
+
+            //previous runs ending left of this run cannot touch it or any later one
+            while (previous != mPrevious.end() && previous->mEnd + 1 < run->mStart)
+            {
+               ++previous;
+            }
+            for (std::vector<EdgeRun>::const_iterator touching = previous;
+               touching != mPrevious.end() && touching->mStart <= run->mEnd + 1; ++touching)
+            {
+               if (mRowInStrip == 0)
+               {
+                  //the row above is in the strip above, whose runs are labeled in the equivalence table already
+                  mBorder.push_back(std::make_pair(run->mLabel, touching->mLabel));
+               }
+               else
+               {
+                  join(mStripParents, mStripStrong, run->mLabel, touching->mLabel);
+               }
+            }
+         }
+         std::swap(mPrevious, mCurrent);
+
+         if (++mRowInStrip == mStripRows)
+         {
+            finishStrip();
+         }
+      }
+
+      //ends the labeling, after the last row
+      void finishLabels()
+      {
+         if (mRowInStrip > 0)
+         {
+            finishStrip();
+         }
+         mPrevious.clear();
+         mNextRun = 0;
+      }
+
+      //replaces the classes of the next row, from the first row down, with the edge mask
+      void resolveRow(unsigned char* pClasses, unsigned int colSize)
+      {
+         findRuns(pClasses, colSize, mCurrent);
+         std::fill(pClasses, pClasses + colSize, 0);
+         for (std::vector<EdgeRun>::const_iterator run = mCurrent.begin(); run != mCurrent.end(); ++run)
+         {
+            if (mStrong[find(mParents, mRunComponents[mNextRun++])])
+            {
+               std::fill(pClasses + run->mStart, pClasses + run->mEnd + 1, 1);
+            }
+         }
+      }
+
+   private:
+      struct EdgeRun
+      {
+         unsigned int mStart;
+         unsigned int mEnd;
+         unsigned int mLabel;
+         bool mStrong;
+      };
+
+      void findRuns(const unsigned char* pClasses, unsigned int colSize, std::vector<EdgeRun>& runs)
+      {
+         runs.clear();
+         for (unsigned int col = 0; col < colSize; ++col)
+         {
+            if (pClasses[col] == 0)
+            {
+               continue;
+            }
+            if (runs.empty() || runs.back().mEnd + 1 != col)
+            {
+               EdgeRun run = { col, col, 0, false };
+               runs.push_back(run);
+            }
+            runs.back().mEnd = col;
+            runs.back().mStrong = runs.back().mStrong || pClasses[col] == 2;
+         }
+      }
+
+      //gives the strip's components entries in the equivalence table and merges them across the strip's top border
+      void finishStrip()
+      {
+         std::vector<unsigned int> components(mStripParents.size(), std::numeric_limits<unsigned int>::max());
+         for (unsigned int label = 0; label < mStripParents.size(); ++label)
+         {
+            unsigned int root = find(mStripParents, label);
+            if (components[root] == std::numeric_limits<unsigned int>::max())
+            {
+               components[root] = mParents.size();
+               mParents.push_back(components[root]);
+               mStrong.push_back(mStripStrong[root]);
+            }
+            components[label] = components[root];
+         }
+         for (std::vector<unsigned int>::const_iterator label = mStripLabels.begin(); label != mStripLabels.end();
+            ++label)
+         {
+            mRunComponents.push_back(components[*label]);
+         }
+         for (std::vector<std::pair<unsigned int, unsigned int> >::const_iterator border = mBorder.begin();
+            border != mBorder.end(); ++border)
+         {
+            join(mParents, mStrong, components[border->first], border->second);
+         }
+
+         //the last row's runs are labeled by their table entries for the next strip's border
+         for (std::vector<EdgeRun>::iterator run = mPrevious.begin(); run != mPrevious.end(); ++run)
+         {
+            run->mLabel = components[run->mLabel];
+         }
+         mStripParents.clear();
+         mStripStrong.clear();
+         mStripLabels.clear();
+         mBorder.clear();
+         mRowInStrip = 0;
+      }
+
+      static unsigned int find(std::vector<unsigned int>& parents, unsigned int label)
+      {
+         while (parents[label] != label)
+         {
+            parents[label] = parents[parents[label]];
+            label = parents[label];
+         }
+         return label;
+      }
+
+      static void join(std::vector<unsigned int>& parents, std::vector<bool>& strong, unsigned int first,
+         unsigned int second)
+      {
+         first = find(parents, first);
+         second = find(parents, second);
+         if (first != second)
+         {
+            parents[second] = first;
+            strong[first] = strong[first] || strong[second];
+         }
+      }
+
+      unsigned int mStripRows;
+      unsigned int mRowInStrip;
+
+      //the union-find of the strip being labeled, and the label of each of its runs in order
+      std::vector<unsigned int> mStripParents;
+      std::vector<bool> mStripStrong;
+      std::vector<unsigned int> mStripLabels;
+      std::vector<std::pair<unsigned int, unsigned int> > mBorder; //strip label, table entry of a run above
+
+      //the equivalence table of the strips' components, and the entry of every run of the image in order
+      std::vector<unsigned int> mParents;
+      std::vector<bool> mStrong;
+      std::vector<unsigned int> mRunComponents;
+      unsigned int mNextRun;
+
+      std::vector<EdgeRun> mPrevious;
+      std::vector<EdgeRun> mCurrent;
+   };
+
+   //a result element can be written over if it has the shape and data type a new one would have
+   bool isCompatibleResult(const RasterElement* pResult, const RasterDataDescriptor* pSrcDesc, EncodingType resultType)
+   {
+      const RasterDataDescriptor* pResultDesc = (pResult == NULL) ? NULL :
+         dynamic_cast<const RasterDataDescriptor*>(pResult->getDataDescriptor());
+      return pResultDesc != NULL && pResultDesc->getRowCount() == pSrcDesc->getRowCount() &&
+         pResultDesc->getColumnCount() == pSrcDesc->getColumnCount() && pResultDesc->getBandCount() == 1 &&
+         pResultDesc->getDataType() == resultType;
+   }
+
+   //Maps magnitudes onto a scaled integer output: (magnitude - mOffset) * mScale, rounded and clamped to
+   //[0, mMaximum]. Unscaled outputs store the magnitude as is.
+   struct OutputScale
+   {
+      bool mScaled;
+      double mOffset;
+      double mScale;
+      double mMaximum;
+   };
+
+   template<typename T>
+   void writeRow(T* pData, const std::vector<double>& magnitude, const OutputScale& scale)
+   {
+      //pData is a pointer a type T. Note that T can be an integer, float, double etc.
+      if (!scale.mScaled)
+      {
+         for (unsigned int col = 0; col < magnitude.size(); ++col)
+         {
+            pData[col] = static_cast<T>(magnitude[col]);
+         }
+         return;
+      }
+
+      //the scale and clamp are fused into the store, so there is no intermediate double row to write
+      for (unsigned int col = 0; col < magnitude.size(); ++col)
+      {
+         double value = (magnitude[col] - scale.mOffset) * scale.mScale;
+         pData[col] = static_cast<T>(std::min(std::max(value, 0.0), scale.mMaximum) + 0.5);
+      }
+   }
+
+   //Magnitude range over a sample of evenly spaced rows, for scaling when no range is given. Returns false when
+   //the sample has no valid pixels.
+   bool estimateRange(RasterElement* pCube, const RasterDataDescriptor* pDesc, const BadValueMask& mask,
+      double& minimum, double& maximum)
+   {
+      const unsigned int sampleRows = 64;
+      unsigned int rowSize = pDesc->getRowCount();
+      unsigned int colSize = pDesc->getColumnCount();
+      unsigned int step = std::max(rowSize / sampleRows, 1u);
+      minimum = std::numeric_limits<double>::max();
+      maximum = -std::numeric_limits<double>::max();
+      std::vector<SourceRow> window(3);
+      std::vector<double> magnitude;
+      for (unsigned int row = step / 2; row < rowSize; row += step)
+      {
+         unsigned int firstRow = (row > 0) ? row - 1 : row;
+         unsigned int lastRow = std::min(row + 1, rowSize - 1);
+         FactoryResource<DataRequest> pRequest;
+         pRequest->setRows(pDesc->getActiveRow(firstRow), pDesc->getActiveRow(lastRow));
+         pRequest->setBands(pDesc->getActiveBand(0), pDesc->getActiveBand(0));
+         pRequest->setInterleaveFormat(BSQ);
+         DataAccessor pAcc = pCube->getDataAccessor(pRequest.release());
+         for (unsigned int windowRow = firstRow; windowRow <= lastRow; ++windowRow)
+         {
+            if (!pAcc.isValid() || pAcc->getRow() == NULL)
+            {
+               return false;
+            }
+            switchOnEncoding(pDesc->getDataType(), readRow, pAcc->getRow(), colSize, mask,
+               window[windowRow + 1 - row]);
+            pAcc->nextRow();
+         }
+         if (firstRow == row)
+         {
+            window[0] = window[1];
+         }
+         if (lastRow == row)
+         {
+            window[2] = window[1];
+         }
+
+         edgeDetection(window[0], window[1], window[2], colSize, magnitude);
+         for (unsigned int col = 0; col < colSize; ++col)
+         {
+            if (window[1].mValid[col + 1])
+            {
+               minimum = std::min(minimum, magnitude[col]);
+               maximum = std::max(maximum, magnitude[col]);
+            }
+         }
+      }
+      return minimum <= maximum;
+   }
+
+   //One run of Tutorial 5, from its checked inputs and result to the finished result rows. compute() only reads the
+   //source through its RowReader and writes through its RowWriter, and leaves the step, the view and the outputs to
+   //finishBatch().
+   class EdgeKernel : public BatchKernel
+   {
+   public:
+      EdgeKernel() :
+         mStep("Tutorial 5", "app", "5EA0CC75-9E0B-4c3d-BA23-6DB7157BBD54"),
+         mpProgress(NULL),
+         mpCube(NULL),
+         mMask(NULL),
+         mCanny(false),
+         mSigma(1.0),
+         mLowThreshold(0.0),
+         mHighThreshold(0.0),
+         mScaleMinimum(0.0),
+         mScaleMaximum(0.0),
+         mToFile(false),
+         mReused(false),
+         mpResult(NULL),
+         mComputed(false)
+      {
+         OutputScale scale = { false, 0.0, 1.0, 0.0 };
+         mScale = scale;
+      }
+
+      virtual bool compute(QAtomicInt& aborted);
+
+      DeferredStepResource mStep;
+      Progress* mpProgress;
+      RasterElement* mpCube;
+      BadValueMask mMask;
+      std::auto_ptr<RowReader> mpSourceReader; //the source rows, possibly read ahead on another thread.
+      bool mCanny;
+      double mSigma;
+      double mLowThreshold;
+      double mHighThreshold;
+      EncodingType mResultType;
+      OutputScale mScale;
+      double mScaleMinimum;
+      double mScaleMaximum;
+      bool mToFile;
+      bool mReused;
+      RasterElement* mpResult;
+      std::auto_ptr<ModelResource<RasterElement> > mpResultCube; //the result, if it was created for this run.
+      std::auto_ptr<RowWriter> mpDestAcc; //writes the result rows, into the element or the output file.
+
+      bool mComputed;
+      std::string mFailure; //why compute() failed, empty if it was aborted
+   };
+
+   bool EdgeKernel::compute(QAtomicInt& aborted)
+   {
+      const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>(mpCube->getDataDescriptor());
+      if (mScale.mScaled)
+      {
+         mScale.mOffset = mScaleMinimum;
+         mScale.mScale = (mScaleMaximum > mScaleMinimum) ? mScale.mMaximum / (mScaleMaximum - mScaleMinimum) : 0.0;
+      }
+
+      //The source is streamed a row at a time through a window of three rows, so each pixel is read once.
+      RowReader& srcReader = *mpSourceReader;
+      RowWriter* pDestAcc = mpDestAcc.get();
+      unsigned int rowSize = pDesc->getRowCount();
+      unsigned int colSize = pDesc->getColumnCount();
+      std::vector<SourceRow> window(3);
+      std::vector<double> magnitude;
+
+      //In Canny mode the first pass writes each pixel's threshold class to the result and labels its runs, and the
+      //second pass replaces the classes with the linked edge mask, so no full size intermediate is needed.
+      SmoothedRows smoothedRows(srcReader, pDesc->getDataType(), colSize, rowSize, mMask, mSigma);
+      GradientRows gradientRows(smoothedRows, colSize, rowSize);
+      std::vector<GradientRow> gradients(3);
+      EdgeLinker linker(sLinkStripRows);
+      int lastPercent = mCanny ? 90 : 100;
+      for (unsigned int row = 0; row < rowSize; ++row) //traverse row-wise
+      {
+         if (mpProgress != NULL) //update the progress bar with the fraction of rows computed already.
+         {
+            mpProgress->updateProgress("Calculating result", row * lastPercent / rowSize, NORMAL);
+         }
+
+         //handle the two errors that are likely to occur.
+         if (aborted != 0)
+         {
+            return false;
+         }
+
+         //gradients or window rows [0], [1] and [2] hold the rows above, at and below this one
+         bool haveRows = true;
+         if (mCanny)
+         {
+            //gradient rows are zero outside the image
+            if (row == 0)
+            {
+               gradients[0].mMagnitude.assign(colSize + 2, 0.0);
+               gradients[0].mSector.assign(colSize + 2, 0);
+               haveRows = gradientRows.read(gradients[1]);
+               gradients[2] = gradients[0];
+               if (haveRows && rowSize > 1)
+               {
+                  haveRows = gradientRows.read(gradients[2]);
+               }
+            }
+            else
+            {
+               std::swap(gradients[0], gradients[1]);
+               std::swap(gradients[1], gradients[2]);
+               if (row + 1 < rowSize)
+               {
+                  haveRows = gradientRows.read(gradients[2]);
+               }
+               else
+               {
+                  gradients[2].mMagnitude.assign(colSize + 2, 0.0);
+               }
+            }
+         }
+         else if (row == 0)
+         {
+            //source rows past the image edges repeat the edge row
+            haveRows = readSourceRow(srcReader, pDesc->getDataType(), colSize, mMask, window[1]);
+            window[0] = window[1];
+            window[2] = window[1];
+            if (haveRows && rowSize > 1)
+            {
+               haveRows = readSourceRow(srcReader, pDesc->getDataType(), colSize, mMask, window[2]);
+            }
+         }
+         else
+         {
+            std::swap(window[0], window[1]);
+            std::swap(window[1], window[2]);
+            if (row + 1 < rowSize)
+            {
+               haveRows = readSourceRow(srcReader, pDesc->getDataType(), colSize, mMask, window[2]);
+            }
+            else
+            {
+               window[2] = window[1];
+            }
+         }
 
-	  //These two components are perpendicular to one another. Hence, magnitude of their vector addition leads to:
-      double magnitude = sqrt(gx * gx + gy * gy);
+         if (!haveRows || !pDestAcc->isValid() || pDestAcc->getRow() == NULL)
+         {
+            mFailure = "Unable to access the cube data.";
+            return false;
+         }
+
+         if (mCanny)
+         {
+            unsigned char* pClasses = reinterpret_cast<unsigned char*>(pDestAcc->getRow());
+            suppressRow(gradients[0], gradients[1], gradients[2], mLowThreshold, mHighThreshold, pClasses);
+            linker.addRow(pClasses, colSize);
+            pDestAcc->nextRow();
+            continue;
+         }
 
-	  //pData is a pointer a type T. Note that T can be an integer, float, double etc.
-      *pData = static_cast<T>(magnitude);
+         edgeDetection(window[0], window[1], window[2], colSize, magnitude);
+         switchOnEncoding(mResultType, writeRow, pDestAcc->getRow(), magnitude, mScale);
+         pDestAcc->nextRow();
+      }
+
+      if (mCanny)
+      {
+         linker.finishLabels();
+         for (unsigned int row = 0; row < rowSize; ++row)
+         {
+            if (mpProgress != NULL)
+            {
+               mpProgress->updateProgress("Linking edges", lastPercent + row * (100 - lastPercent) / rowSize, NORMAL);
+            }
+            if (aborted != 0)
+            {
+               return false;
+            }
+            pDestAcc->toRow(row);
+            if (!pDestAcc->isValid() || pDestAcc->getRow() == NULL)
+            {
+               mFailure = "Unable to access the cube data.";
+               return false;
+            }
+            linker.resolveRow(reinterpret_cast<unsigned char*>(pDestAcc->getRow()), colSize);
+         }
+      }
+
+      //an output file is only kept, with its header, once every row is written
+      if (!mpDestAcc->finish())
+      {
+         mFailure = "Unable to write the output file.";
+         return false;
+      }
+      mpDestAcc.reset();
+      mComputed = true;
+      return true;
    }
 };
 
-Tutorial5::Tutorial5() //"The usual"
+Tutorial5::Tutorial5() : //"The usual"
+   mAborted(0)
 {
    setDescriptorId("{BE00BBC3-A1E3-4b0d-8780-1B5D9A8620CC}");
    setName("Tutorial 5");
@@ -118,6 +878,31 @@ bool Tutorial5::getInputSpecification(PlugInArgList*& pInArgList)
    VERIFY(pInArgList = Service<PlugInManagerServices>()->getPlugInArgList());
    pInArgList->addArg<Progress>(Executable::ProgressArg(), NULL, "Progress reporter"); //we need a progress bar for this to indicate the percentage of completion
    pInArgList->addArg<RasterElement>(Executable::DataElementArg(), "Perform edge detection on this data element"); // since we're applying an edge detection algorithm, we need to add the raster element to the input argument list.
+   pInArgList->addArg<unsigned int>("Level", 0, "Perform edge detection on this pyramid level, built by Tutorial 6 if needed. 0 is full resolution.");
+   pInArgList->addArg<double>("No Data Value", "Pixels with this value are ignored, along with the bad values of the raster element");
+   RowReader::addReadAheadArgs(pInArgList);
+   pInArgList->addArg<std::string>("Output Type", std::string("Source"), "Data type of the gradient magnitude: Source for "
+      "the source data type, UINT8 Scaled or UINT16 Scaled to scale the magnitude range onto 1 or 2 byte unsigned "
+      "integers, or FLT4 for 4 byte floats. An Output File cannot hold 1 byte signed or complex integer data, so those "
+      "sources need another output type when writing to a file.");
+   pInArgList->addArg<double>("Scale Minimum", "Magnitude stored as 0 by the scaled output types. Estimated from a "
+      "sample of rows if not given.");
+   pInArgList->addArg<double>("Scale Maximum", "Magnitude stored as the largest value by the scaled output types. "
+      "Estimated from a sample of rows if not given.");
+   pInArgList->addArg<bool>("Canny", false, "Find one pixel wide edges with the Canny method and return them as a mask "
+      "of 1 for edge pixels and 0 elsewhere, instead of the gradient magnitude.");
+   pInArgList->addArg<double>("Gaussian Sigma", 1.0, "Standard deviation in pixels of the smoothing applied before the Canny "
+      "gradient. 0 does not smooth.");
+   pInArgList->addArg<double>("Low Threshold", "Canny gradient magnitude for weak edge pixels, which are kept only when "
+      "connected to a strong one");
+   pInArgList->addArg<double>("High Threshold", "Canny gradient magnitude for strong edge pixels");
+   pInArgList->addArg<RasterElement>("Result", NULL, "Write the result into this raster element instead of creating one. "
+      "It must have one band and the same size as the source, and the output type for the gradient magnitude or 1 byte "
+      "unsigned integers for the Canny mask.");
+   pInArgList->addArg<bool>("Reuse Result", false, "Write the result into a shared element kept for this size and data "
+      "type, so repeated runs do not allocate a new one each time. Otherwise each run creates a new element.");
+   pInArgList->addArg<std::string>("Output File", std::string(), "Write the result straight into this raw file, with an "
+      "ENVI header beside it, instead of a raster element. No result element is created or returned.");
    return true;
 }
 
@@ -130,11 +915,24 @@ bool Tutorial5::getOutputSpecification(PlugInArgList*& pOutArgList)
 
 bool Tutorial5::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
 {
-   StepResource pStep("Tutorial 5", "app", "5EA0CC75-9E0B-4c3d-BA23-6DB7157BBD54");
-   if (pInArgList == NULL || pOutArgList == NULL) //"The usual"
+   //The run is split so that Tutorial 7 can do the calculation on its own threads, see BatchKernel.h.
+   std::auto_ptr<BatchKernel> pKernel(prepareBatch(pInArgList));
+   if (pKernel.get() == NULL)
    {
       return false;
    }
+   pKernel->compute(mAborted);
+   return finishBatch(pKernel.get(), pOutArgList);
+}
+
+BatchKernel* Tutorial5::prepareBatch(PlugInArgList* pInArgList)
+{
+   std::auto_ptr<EdgeKernel> pKernel(new EdgeKernel);
+   DeferredStep* pStep = pKernel->mStep.get();
+   if (pInArgList == NULL) //"The usual"
+   {
+      return NULL;
+   }
    Progress* pProgress = pInArgList->getPlugInArgValue<Progress>(Executable::ProgressArg()); //initialize the progress panel
    RasterElement* pCube = pInArgList->getPlugInArgValue<RasterElement>(Executable::DataElementArg());  //pCube is the Rastering element. It is finally used to create a data accessor element and a data desriptor element.
    if (pCube == NULL) //if no image data is open
@@ -145,10 +943,29 @@ bool Tutorial5::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
       {
          pProgress->updateProgress(msg, 0, ERRORS);
       }
-      return false;
+      return NULL;
+   }
+   unsigned int level = 0;
+   pInArgList->getPlugInArgValue("Level", level);
+   if (level > 0)
+   {
+      //run on a reduced resolution overview instead of the full cube
+      pCube = Tutorial6::getLevel(pCube, level, pProgress);
+      if (pCube == NULL)
+      {
+         std::string msg = "Pyramid level " + StringUtilities::toDisplayString(level) + " is not available.";
+         pStep->finalize(Message::Failure, msg);
+         if (pProgress != NULL)
+         {
+            pProgress->updateProgress(msg, 0, ERRORS);
+         }
+
+         return NULL;
+      }
    }
+
    RasterDataDescriptor* pDesc = static_cast<RasterDataDescriptor*>(pCube->getDataDescriptor());
-   VERIFY(pDesc != NULL); //ensure that this data isnt NULL. If it is, an appropriate error is logged and the code is exited.
+   VERIFYRV(pDesc != NULL, NULL); //ensure that this data isnt NULL. If it is, an appropriate error is logged and the code is exited.
 
    if (pDesc->getDataType() == INT4SCOMPLEX || pDesc->getDataType() == FLT8COMPLEX)
 	   //these are the two available complex types. But what exactly is a complex type in the first place?
@@ -159,73 +976,250 @@ bool Tutorial5::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
       {
          pProgress->updateProgress(msg, 0, ERRORS);
       }
-      return false;
+      return NULL;
    }
 
-   FactoryResource<DataRequest> pRequest; //same as #4
-   pRequest->setInterleaveFormat(BSQ);
-   DataAccessor pSrcAcc = pCube->getDataAccessor(pRequest.release());
+   double noDataValue = 0.0;
+   bool hasNoDataValue = pInArgList->getPlugInArgValue("No Data Value", noDataValue);
+   BadValueMask mask(pDesc, hasNoDataValue ? &noDataValue : NULL);
+
+   unsigned int readAheadRows = 0;
+   unsigned int readAheadDepth = 0;
+   RowReader::getReadAheadArgs(pInArgList, readAheadRows, readAheadDepth);
+   pKernel->mpSourceReader.reset(new RowReader(pCube, 0, pDesc->getRowCount() - 1, 0, pDesc->getColumnCount() - 1,
+      readAheadRows, readAheadDepth)); //the source rows, possibly read ahead on another thread while the result is calculated.
 
-   ModelResource<RasterElement> pResultCube(RasterUtilities::createRasterElement(pCube->getName() +
-      "_Edge_Detection_Result", pDesc->getRowCount(), pDesc->getColumnCount(), pDesc->getDataType())); //I didnt quite get the meaning of this.
-   if (pResultCube.get() == NULL)
+   bool canny = false;
+   double sigma = 1.0;
+   double lowThreshold = 0.0;
+   double highThreshold = 0.0;
+   pInArgList->getPlugInArgValue("Canny", canny);
+   pInArgList->getPlugInArgValue("Gaussian Sigma", sigma);
+   if (canny && (!pInArgList->getPlugInArgValue("Low Threshold", lowThreshold) ||
+      !pInArgList->getPlugInArgValue("High Threshold", highThreshold) || lowThreshold > highThreshold || sigma < 0.0))
    {
-      std::string msg = "A raster cube could not be created.";
+      std::string msg = "Canny edge detection needs a low threshold no greater than the high threshold, "
+         "and a sigma which is not negative.";
       pStep->finalize(Message::Failure, msg);
       if (pProgress != NULL) 
       {
          pProgress->updateProgress(msg, 0, ERRORS);
       }
-      return false;
+      return NULL;
    }
-   FactoryResource<DataRequest> pResultRequest;
-   pResultRequest->setWritable(true); //this setting allows us to change the underlying data that is obtained via the data accessor. This allows us to store the edge detection result.
-   DataAccessor pDestAcc = pResultCube->getDataAccessor(pResultRequest.release());
-
-   for (unsigned int row = 0; row < pDesc->getRowCount(); ++row) //traverse row-wise
+   std::string outputType = "Source";
+   pInArgList->getPlugInArgValue("Output Type", outputType);
+   OutputScale scale = { false, 0.0, 1.0, 0.0 };
+   EncodingType resultType = pDesc->getDataType();
+   if (canny)
+   {
+      resultType = INT1UBYTE;
+   }
+   else if (outputType == "UINT8 Scaled" || outputType == "UINT16 Scaled")
+   {
+      resultType = (outputType == "UINT8 Scaled") ? INT1UBYTE : INT2UBYTES;
+      scale.mScaled = true;
+      scale.mMaximum = (resultType == INT1UBYTE) ? std::numeric_limits<unsigned char>::max() :
+         std::numeric_limits<unsigned short>::max();
+   }
+   else if (outputType == "FLT4")
+   {
+      resultType = FLT4BYTES;
+   }
+   else if (outputType != "Source")
    {
-      if (pProgress != NULL) //update the progress bar with the fraction of rows computed already.
+      std::string msg = "The output type must be Source, UINT8 Scaled, UINT16 Scaled or FLT4.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL) 
       {
-         pProgress->updateProgress("Calculating result", row * 100 / pDesc->getRowCount(), NORMAL);
+         pProgress->updateProgress(msg, 0, ERRORS);
       }
+      return NULL;
+   }
 
-	  //handle the two errors that are likely to occur.
-      if (isAborted())
+   if (scale.mScaled)
+   {
+      double scaleMinimum = 0.0;
+      double scaleMaximum = 0.0;
+      bool estimateMinimum = !pInArgList->getPlugInArgValue("Scale Minimum", scaleMinimum);
+      bool estimateMaximum = !pInArgList->getPlugInArgValue("Scale Maximum", scaleMaximum);
+      if (estimateMinimum || estimateMaximum)
       {
-         std::string msg = getName() + " has been aborted.";
-         pStep->finalize(Message::Abort, msg);
+         //a missing end of the range is estimated from a sample of rows, which is read here rather than by
+         //compute() as it needs accessors of its own
          if (pProgress != NULL)
          {
-            pProgress->updateProgress(msg, 0, ABORT);
+            pProgress->updateProgress("Estimating the magnitude range", 0, NORMAL);
          }
-         return false;
+         double sampleMinimum = 0.0;
+         double sampleMaximum = 0.0;
+         if (!estimateRange(pCube, pDesc, mask, sampleMinimum, sampleMaximum))
+         {
+            sampleMinimum = 0.0;
+            sampleMaximum = 0.0;
+         }
+         scaleMinimum = estimateMinimum ? sampleMinimum : scaleMinimum;
+         scaleMaximum = estimateMaximum ? sampleMaximum : scaleMaximum;
       }
+      pKernel->mScaleMinimum = scaleMinimum;
+      pKernel->mScaleMaximum = scaleMaximum;
+   }
 
-      if (!pDestAcc.isValid())
+   //With an output file the rows go straight into a mapped file, so there is no element to create, fill and export.
+   std::string outputFile;
+   pInArgList->getPlugInArgValue("Output File", outputFile);
+   bool toFile = !outputFile.empty();
+
+   //Every result pixel is overwritten, so an existing element of the right shape is as good as a new one and saves
+   //allocating (and zeroing) a full size cube. It comes from the "Result" arg or, when asked for, the shared pool.
+   //Otherwise the result is a new element, so an earlier result which may still be on display is left alone.
+   bool reuseResult = false;
+   pInArgList->getPlugInArgValue("Reuse Result", reuseResult);
+   std::string ownResultName = pCube->getName() + (canny ? "_Canny_Edges" : "_Edge_Detection_Result");
+   std::string resultName = (canny ? "Canny_Edges_" : "Edge_Detection_Result_") +
+      StringUtilities::toDisplayString(pDesc->getRowCount()) + "x" +
+      StringUtilities::toDisplayString(pDesc->getColumnCount()) + "_" +
+      StringUtilities::toDisplayString(static_cast<int>(resultType));
+   RasterElement* pResult = toFile ? NULL : pInArgList->getPlugInArgValue<RasterElement>("Result");
+   if (pResult != NULL && (!isCompatibleResult(pResult, pDesc, resultType) || pResult == pCube))
+   {
+      std::string msg = canny ? "The result raster element must have one band, the same size as the source and "
+         "1 byte unsigned integer data." : "The result raster element must have one band, the same size as the source "
+         "and the output data type.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL) 
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return NULL;
+   }
+   if (pResult == NULL && reuseResult && !toFile)
+   {
+      pResult = static_cast<RasterElement*>(Service<ModelServices>()->getElement(resultName,
+         TypeConverter::toString<RasterElement>(), NULL));
+      if (pResult == pCube)
       {
-         std::string msg = "Unable to access the cube data.";
+         //the source is the pooled result itself, which would be overwritten while its rows are still being read
+         //through the window, so it gets a result of its own
+         pResult = NULL;
+         reuseResult = false;
+      }
+      else if (pResult != NULL && !isCompatibleResult(pResult, pDesc, resultType))
+      {
+         std::string msg = "The raster element " + resultName + " kept for reused results does not have one band, "
+            "the same size as the source and the output data type.";
          pStep->finalize(Message::Failure, msg);
          if (pProgress != NULL) 
          {
             pProgress->updateProgress(msg, 0, ERRORS);
          }
-         return false;
+         return NULL;
       }
-      for (unsigned int col = 0; col < pDesc->getColumnCount(); ++col)
+   }
+   if (!reuseResult)
+   {
+      resultName = RowWriter::getUnusedElementName(ownResultName);
+   }
+
+   bool reused = (pResult != NULL);
+   pKernel->mpResultCube.reset(new ModelResource<RasterElement>((reused || toFile) ? NULL :
+      RasterUtilities::createRasterElement(resultName, pDesc->getRowCount(), pDesc->getColumnCount(),
+      resultType))); //I didnt quite get the meaning of this.
+   std::auto_ptr<RowWriter>& pDestAcc = pKernel->mpDestAcc;
+   if (toFile)
+   {
+      pDestAcc.reset(new RowWriter(outputFile, pDesc->getRowCount(), pDesc->getColumnCount(), resultType));
+      if (!pDestAcc->isValid())
       {
-         switchOnEncoding(pDesc->getDataType(), edgeDetection, pDestAcc->getColumn(), pSrcAcc, row, col,
-            pDesc->getRowCount(), pDesc->getColumnCount()); //This internally calls the edgeDetection function defined in the namespace with the following arguments as parameters (in their respective order)
-         pDestAcc->nextColumn();
+         std::string msg = "Unable to create the output file " + outputFile + ". It must be writable, and the "
+            "output type one which an ENVI header can describe.";
+         pStep->finalize(Message::Failure, msg);
+         if (pProgress != NULL) 
+         {
+            pProgress->updateProgress(msg, 0, ERRORS);
+         }
+         return NULL;
+      }
+      pStep->addProperty("Output File", outputFile);
+   }
+   else
+   {
+      if (!reused)
+      {
+         pResult = pKernel->mpResultCube->get();
+      }
+      if (pResult == NULL)
+      {
+         std::string msg = "A raster cube could not be created.";
+         pStep->finalize(Message::Failure, msg);
+         if (pProgress != NULL) 
+         {
+            pProgress->updateProgress(msg, 0, ERRORS);
+         }
+         return NULL;
       }
+      pStep->addProperty("Reused Result", reused);
+      pDestAcc.reset(new RowWriter(pResult)); //writable, so the edge detection result can be stored in the element.
+   }
+
+   pKernel->mpProgress = pProgress;
+   pKernel->mpCube = pCube;
+   pKernel->mMask = mask;
+   pKernel->mCanny = canny;
+   pKernel->mSigma = sigma;
+   pKernel->mLowThreshold = lowThreshold;
+   pKernel->mHighThreshold = highThreshold;
+   pKernel->mResultType = resultType;
+   pKernel->mScale = scale;
+   pKernel->mToFile = toFile;
+   pKernel->mReused = reused;
+   pKernel->mpResult = pResult;
+   return pKernel.release();
+}
 
-      pDestAcc->nextRow();
+bool Tutorial5::finishBatch(BatchKernel* pKernel, PlugInArgList* pOutArgList)
+{
+   EdgeKernel* pEdgeKernel = dynamic_cast<EdgeKernel*>(pKernel);
+   if (pEdgeKernel == NULL || pOutArgList == NULL) //the step is failed when the kernel is destroyed
+   {
+      return false;
+   }
+   DeferredStep* pStep = pEdgeKernel->mStep.get();
+   Progress* pProgress = pEdgeKernel->mpProgress;
+   if (!pEdgeKernel->mComputed)
+   {
+      bool aborted = pEdgeKernel->mFailure.empty();
+      std::string msg = aborted ? getName() + " has been aborted." : pEdgeKernel->mFailure;
+      pStep->finalize(aborted ? Message::Abort : Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, aborted ? ABORT : ERRORS);
+      }
+      return false;
+   }
+   if (pEdgeKernel->mScale.mScaled)
+   {
+      pStep->addProperty("Scale Minimum", pEdgeKernel->mScaleMinimum);
+      pStep->addProperty("Scale Maximum", pEdgeKernel->mScaleMaximum);
    }
 
-   if (!isBatch()) //If its not processed in batch. But I didnt exactly understand what batch processing means.
+   if (pEdgeKernel->mToFile)
    {
-      Service<DesktopServices> pDesktop; //invoke desktop services,
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress("Tutorial5 is compete.", 100, NORMAL);
+      }
+      pStep->finalize();
+      return true;
+   }
+
+   RasterElement* pResult = pEdgeKernel->mpResult;
+   pResult->updateData(); //lets any view already showing a reused result refresh.
 
-      SpatialDataWindow* pWindow = static_cast<SpatialDataWindow*>(pDesktop->createWindow(pResultCube->getName(),
+   Service<DesktopServices> pDesktop; //invoke desktop services,
+   if (!isBatch() && (!pEdgeKernel->mReused || pDesktop->getWindow(pResult->getName(), SPATIAL_DATA_WINDOW) == NULL)) //If its not processed in batch. But I didnt exactly understand what batch processing means.
+   {
+      SpatialDataWindow* pWindow = static_cast<SpatialDataWindow*>(pDesktop->createWindow(pResult->getName(),
          SPATIAL_DATA_WINDOW)); //SpatialDataWindow creates a new window inside opticks. for this, pDesktop->createWindow is called with the arguments - window Name, type.
 
       SpatialDataView* pView = (pWindow == NULL) ? NULL : pWindow->getSpatialDataView(); //what exactly is a SpatialDataView? Is it the rasterized version?
@@ -240,8 +1234,8 @@ bool Tutorial5::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
          return false;
       }
 
-      pView->setPrimaryRasterElement(pResultCube.get()); //didnt get as to why these have to be done.
-      pView->createLayer(RASTER, pResultCube.get());
+      pView->setPrimaryRasterElement(pResult); //didnt get as to why these have to be done.
+      pView->createLayer(RASTER, pResult);
    }
 
    if (pProgress != NULL)
@@ -249,9 +1243,16 @@ bool Tutorial5::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
       pProgress->updateProgress("Tutorial5 is compete.", 100, NORMAL);
    }
 
-   //pOutArgList->setPlugInArgValue("Tutorial5_Result", pResultCube.release()); //This is used to set the raster element as the output argument. 
-   //Commenting this line should result in the output not being displayed. Right? Yes.
+   //The result now lives on in the model (and is found again by the next run), so it is handed back as the output.
+   pEdgeKernel->mpResultCube->release();
+   pOutArgList->setPlugInArgValue("Result", pResult);
 
    pStep->finalize();
    return true;
 }
+
+bool Tutorial5::abort()
+{
+   mAborted = 1;
+   return ExecutableShell::abort();
+}
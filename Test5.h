@@ -10,9 +10,11 @@
 #ifndef TUTORIAL5_H
 #define TUTORIAL5_H
 
+#include "BatchKernel.h"
 #include "ExecutableShell.h"
+#include <QtCore/QAtomicInt>
 
-class Tutorial5 : public ExecutableShell
+class Tutorial5 : public ExecutableShell, public BatchOperation
 {
 public:
    Tutorial5();
@@ -21,6 +23,13 @@ public:
    virtual bool getInputSpecification(PlugInArgList*& pInArgList);
    virtual bool getOutputSpecification(PlugInArgList*& pOutArgList);
    virtual bool execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList);
+   virtual bool abort();
+
+   virtual BatchKernel* prepareBatch(PlugInArgList* pInArgList);
+   virtual bool finishBatch(BatchKernel* pKernel, PlugInArgList* pOutArgList);
+
+private:
+   QAtomicInt mAborted;
 };
 
 #endif
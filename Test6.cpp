@@ -0,0 +1,454 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "AppVerify.h"
+#include "BadValueMask.h"
+#include "DataAccessor.h"
+#include "DataAccessorImpl.h"
+#include "DataRequest.h"
+#include "MessageLogResource.h"
+#include "ModelServices.h"
+#include "ObjectResource.h"
+#include "PlugInArgList.h"
+#include "PlugInManagerServices.h"
+#include "PlugInRegistration.h"
+#include "PlugInResource.h"
+#include "Progress.h"
+#include "RasterDataDescriptor.h"
+#include "RasterElement.h"
+#include "RasterUtilities.h"
+#include "StepLog.h"
+#include "StringUtilities.h"
+#include "switchOnEncoding.h"
+#include "Test6.h"
+#include "TypeConverter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+REGISTER_PLUGIN_BASIC(OpticksTutorial, Tutorial6);
+
+namespace
+{
+   //automatic level count stops once the larger dimension is no more than this
+   const unsigned int sMinimumLevelSize = 512;
+
+   //Running 2x2 sums for one pyramid level. The sums and counts are of original source samples, so every level is
+   //the exact mean of its block of the source rather than a mean of rounded means.
+   struct LevelAccumulator
+   {
+      std::vector<double> mSums;
+      std::vector<unsigned int> mCounts;
+      unsigned int mRowsIn;
+      unsigned int mInputRow;
+      unsigned int mInputRowCount;
+   };
+
+   template<typename T>
+   void addSourceRow(T* pData, unsigned int columnCount, const BadValueMask& mask, LevelAccumulator& acc)
+   {
+      for (unsigned int col = 0; col < columnCount; ++col)
+      {
+         double value = static_cast<double>(pData[col]);
+         bool valid = mask.isValid(value);
+         acc.mSums[col >> 1] += valid ? value : 0.0;
+         acc.mCounts[col >> 1] += valid;
+      }
+   }
+
+   template<typename T>
+   void writeMeans(T* pData, const LevelAccumulator& acc, double fillValue)
+   {
+      for (unsigned int col = 0; col < acc.mSums.size(); ++col)
+      {
+         double value = (acc.mCounts[col] == 0) ? fillValue : acc.mSums[col] / acc.mCounts[col];
+         if (std::numeric_limits<T>::is_integer)
+         {
+            value = std::floor(value + 0.5);
+         }
+         pData[col] = static_cast<T>(value);
+      }
+   }
+
+   //copies every step'th sample of a row, used for decimation
+   void decimateRow(const char* pSource, char* pDest, unsigned int destColumnCount, unsigned int step,
+      unsigned int bytesPerElement)
+   {
+      for (unsigned int col = 0; col < destColumnCount; ++col)
+      {
+         memcpy(pDest + col * bytesPerElement, pSource + col * step * bytesPerElement, bytesPerElement);
+      }
+   }
+};
+
+Tutorial6::Tutorial6()
+{
+   setDescriptorId("{6A3B1E44-95C2-4F7D-8E0B-2D51C7A9F318}");
+   setName("Tutorial 6");
+   setDescription("Building reduced resolution pyramid levels.");
+   setCreator("Opticks Community");
+   setVersion("Sample");
+   setCopyright("Copyright (C) 2008, Ball Aerospace & Technologies Corp.");
+   setProductionStatus(false);
+   setType("Sample");
+   setSubtype("Pyramid");
+   setMenuLocation("[Tutorial]/Tutorial 6");
+   setAbortSupported(true);
+}
+
+Tutorial6::~Tutorial6()
+{
+}
+
+bool Tutorial6::getInputSpecification(PlugInArgList*& pInArgList)
+{
+   VERIFY(pInArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pInArgList->addArg<Progress>(Executable::ProgressArg(), NULL, "Progress reporter");
+   pInArgList->addArg<RasterElement>(Executable::DataElementArg(), "Build pyramid levels for this raster element");
+   pInArgList->addArg<unsigned int>("Levels", 0, "Number of levels to build, each half the size of the previous one. "
+      "0 keeps halving until the image is no larger than 512 pixels on a side.");
+   pInArgList->addArg<bool>("Decimate", false, "Keep every other pixel instead of averaging each 2x2 block. "
+      "Complex data is always decimated.");
+   pInArgList->addArg<bool>("Keep Existing Levels", false, "Keep the levels an earlier run built and only build the "
+      "missing ones, instead of building every level again in case the source has changed.");
+   return true;
+}
+
+bool Tutorial6::getOutputSpecification(PlugInArgList*& pOutArgList)
+{
+   VERIFY(pOutArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pOutArgList->addArg<unsigned int>("Levels", "The number of levels built");
+   return true;
+}
+
+bool Tutorial6::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
+{
+   DeferredStepResource pStep("Tutorial 6", "app", "0D7C5F2A-3B48-4E91-A6C3-8F2E14B7D905");
+   if (pInArgList == NULL || pOutArgList == NULL)
+   {
+      return false;
+   }
+   Progress* pProgress = pInArgList->getPlugInArgValue<Progress>(Executable::ProgressArg());
+   RasterElement* pCube = pInArgList->getPlugInArgValue<RasterElement>(Executable::DataElementArg());
+   if (pCube == NULL)
+   {
+      std::string msg = "A raster cube must be specified.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+
+      return false;
+   }
+   RasterDataDescriptor* pDesc = static_cast<RasterDataDescriptor*>(pCube->getDataDescriptor());
+   VERIFY(pDesc != NULL);
+
+   unsigned int levels = 0;
+   bool decimate = false;
+   bool keepExisting = false;
+   pInArgList->getPlugInArgValue("Levels", levels);
+   pInArgList->getPlugInArgValue("Decimate", decimate);
+   pInArgList->getPlugInArgValue("Keep Existing Levels", keepExisting);
+   if (pDesc->getDataType() == INT4SCOMPLEX || pDesc->getDataType() == FLT8COMPLEX)
+   {
+      //averaging through double would only keep the magnitude
+      decimate = true;
+   }
+
+   unsigned int rowCount = pDesc->getRowCount();
+   unsigned int columnCount = pDesc->getColumnCount();
+   if (levels == 0)
+   {
+      while ((std::max(rowCount, columnCount) >> levels) > sMinimumLevelSize)
+      {
+         ++levels;
+      }
+   }
+   levels = std::min(levels, 31u);
+   while (levels > 0 && ((rowCount - 1) >> (levels - 1)) == 0 && ((columnCount - 1) >> (levels - 1)) == 0)
+   {
+      --levels;
+   }
+   if (levels == 0)
+   {
+      std::string msg = "The raster element is too small to build pyramid levels.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+
+      return false;
+   }
+   pStep->addProperty("Levels", levels);
+   pStep->addProperty("Decimate", decimate);
+
+   //Level k is (size + 2^k - 1) / 2^k on each side. Old levels are replaced since the source may have changed,
+   //unless they are to be kept; kept levels are still accumulated, as the levels above them are built from the
+   //source samples, but are not written.
+   Service<ModelServices> pModel;
+   std::vector<RasterElement*> levelCubes(levels + 1, NULL);
+   std::vector<bool> created(levels + 1, false);
+   std::vector<unsigned int> levelRows(levels + 1, rowCount);
+   std::vector<unsigned int> levelColumns(levels + 1, columnCount);
+   levelCubes[0] = pCube;
+   for (unsigned int level = 1; level <= levels; ++level)
+   {
+      levelRows[level] = (levelRows[level - 1] + 1) / 2;
+      levelColumns[level] = (levelColumns[level - 1] + 1) / 2;
+      std::string name = getLevelName(pCube, level);
+      RasterElement* pOld = static_cast<RasterElement*>(pModel->getElement(name,
+         TypeConverter::toString<RasterElement>(), pCube));
+      if (pOld != NULL)
+      {
+         const RasterDataDescriptor* pOldDesc = static_cast<const RasterDataDescriptor*>(pOld->getDataDescriptor());
+         if (keepExisting && pOldDesc != NULL && pOldDesc->getRowCount() == levelRows[level] &&
+            pOldDesc->getColumnCount() == levelColumns[level] && pOldDesc->getBandCount() == pDesc->getBandCount() &&
+            pOldDesc->getDataType() == pDesc->getDataType())
+         {
+            levelCubes[level] = pOld;
+            continue;
+         }
+         pModel->destroyElement(pOld);
+      }
+
+      ModelResource<RasterElement> pLevel(RasterUtilities::createRasterElement(name, levelRows[level],
+         levelColumns[level], pDesc->getBandCount(), pDesc->getDataType(), BSQ, true, pCube));
+      if (pLevel.get() == NULL)
+      {
+         std::string msg = "A raster cube could not be created.";
+         pStep->finalize(Message::Failure, msg);
+         if (pProgress != NULL)
+         {
+            pProgress->updateProgress(msg, 0, ERRORS);
+         }
+
+         for (unsigned int previous = 1; previous < level; ++previous)
+         {
+            if (created[previous])
+            {
+               pModel->destroyElement(levelCubes[previous]);
+            }
+         }
+         return false;
+      }
+      static_cast<RasterDataDescriptor*>(pLevel->getDataDescriptor())->setBadValues(pDesc->getBadValues());
+      levelCubes[level] = pLevel.release();
+      created[level] = true;
+   }
+
+   //Every band is streamed through once. Each source row is folded into the level 1 sums; whenever a level has
+   //its two rows (or the last one) it is written out and folded into the next level in turn.
+   BadValueMask mask(pDesc);
+   double fillValue = mask.isEmpty() ? 0.0 : mask.getValues().front();
+   unsigned int bytesPerElement = pDesc->getBytesPerElement();
+   bool success = true;
+   for (unsigned int band = 0; band < pDesc->getBandCount() && success; ++band)
+   {
+      FactoryResource<DataRequest> pRequest;
+      pRequest->setInterleaveFormat(BSQ);
+      pRequest->setBands(pDesc->getActiveBand(band), pDesc->getActiveBand(band));
+      DataAccessor pSrcAcc = pCube->getDataAccessor(pRequest.release());
+
+      //destAccs[destIndex[level]] writes a created level
+      std::vector<DataAccessor> destAccs;
+      std::vector<unsigned int> destIndex(levels + 1, 0);
+      std::vector<LevelAccumulator> accs(levels + 1);
+      for (unsigned int level = 1; level <= levels; ++level)
+      {
+         if (created[level])
+         {
+            const RasterDataDescriptor* pLevelDesc =
+               static_cast<const RasterDataDescriptor*>(levelCubes[level]->getDataDescriptor());
+            FactoryResource<DataRequest> pDestRequest;
+            pDestRequest->setInterleaveFormat(BSQ);
+            pDestRequest->setBands(pLevelDesc->getActiveBand(band), pLevelDesc->getActiveBand(band));
+            pDestRequest->setWritable(true);
+            destIndex[level] = destAccs.size();
+            destAccs.push_back(levelCubes[level]->getDataAccessor(pDestRequest.release()));
+         }
+
+         accs[level].mSums.assign(levelColumns[level], 0.0);
+         accs[level].mCounts.assign(levelColumns[level], 0);
+         accs[level].mRowsIn = 0;
+         accs[level].mInputRow = 0;
+         accs[level].mInputRowCount = levelRows[level - 1];
+      }
+
+      for (unsigned int row = 0; row < rowCount; ++row)
+      {
+         if (isAborted())
+         {
+            std::string msg = getName() + " has been aborted.";
+            pStep->finalize(Message::Abort, msg);
+            if (pProgress != NULL)
+            {
+               pProgress->updateProgress(msg, 0, ABORT);
+            }
+
+            success = false;
+            break;
+         }
+         if (!pSrcAcc.isValid())
+         {
+            std::string msg = "Unable to access the cube data.";
+            pStep->finalize(Message::Failure, msg);
+            if (pProgress != NULL)
+            {
+               pProgress->updateProgress(msg, 0, ERRORS);
+            }
+
+            success = false;
+            break;
+         }
+         if (pProgress != NULL && row % 64 == 0)
+         {
+            pProgress->updateProgress("Building pyramid levels",
+               static_cast<int>((band * rowCount + row) * 100.0 / (pDesc->getBandCount() * rowCount)), NORMAL);
+         }
+
+         if (decimate)
+         {
+            //level k takes the rows and columns which are multiples of 2^k
+            for (unsigned int level = 1; level <= levels && row % (1u << level) == 0; ++level)
+            {
+               if (!created[level])
+               {
+                  continue;
+               }
+               DataAccessor& pDestAcc = destAccs[destIndex[level]];
+               if (!pDestAcc.isValid())
+               {
+                  success = false;
+                  break;
+               }
+               decimateRow(reinterpret_cast<const char*>(pSrcAcc->getRow()), reinterpret_cast<char*>(pDestAcc->getRow()),
+                  levelColumns[level], 1u << level, bytesPerElement);
+               pDestAcc->nextRow();
+            }
+         }
+         else
+         {
+            switchOnEncoding(pDesc->getDataType(), addSourceRow, pSrcAcc->getRow(), columnCount, mask, accs[1]);
+            for (unsigned int level = 1; level <= levels; ++level)
+            {
+               LevelAccumulator& acc = accs[level];
+               ++acc.mRowsIn;
+               ++acc.mInputRow;
+               if (acc.mRowsIn < 2 && acc.mInputRow < acc.mInputRowCount)
+               {
+                  break;
+               }
+
+               if (created[level])
+               {
+                  DataAccessor& pDestAcc = destAccs[destIndex[level]];
+                  if (!pDestAcc.isValid())
+                  {
+                     success = false;
+                     break;
+                  }
+                  switchOnEncoding(pDesc->getDataType(), writeMeans, pDestAcc->getRow(), acc, fillValue);
+                  pDestAcc->nextRow();
+               }
+               if (level < levels)
+               {
+                  LevelAccumulator& next = accs[level + 1];
+                  for (unsigned int col = 0; col < acc.mSums.size(); ++col)
+                  {
+                     next.mSums[col >> 1] += acc.mSums[col];
+                     next.mCounts[col >> 1] += acc.mCounts[col];
+                  }
+               }
+               acc.mSums.assign(acc.mSums.size(), 0.0);
+               acc.mCounts.assign(acc.mCounts.size(), 0);
+               acc.mRowsIn = 0;
+            }
+         }
+         if (!success)
+         {
+            std::string msg = "Unable to access the pyramid level data.";
+            pStep->finalize(Message::Failure, msg);
+            if (pProgress != NULL)
+            {
+               pProgress->updateProgress(msg, 0, ERRORS);
+            }
+
+            break;
+         }
+         pSrcAcc->nextRow();
+      }
+   }
+
+   for (unsigned int level = 1; level <= levels; ++level)
+   {
+      if (!created[level])
+      {
+         continue;
+      }
+      if (success)
+      {
+         levelCubes[level]->updateData();
+      }
+      else
+      {
+         pModel->destroyElement(levelCubes[level]);
+      }
+   }
+   if (!success)
+   {
+      return false;
+   }
+
+   if (pProgress != NULL)
+   {
+      pProgress->updateProgress("Built " + StringUtilities::toDisplayString(levels) + " pyramid levels.", 100, NORMAL);
+   }
+
+   pOutArgList->setPlugInArgValue("Levels", &levels);
+
+   pStep->finalize();
+   return true;
+}
+
+std::string Tutorial6::getLevelName(const RasterElement* pCube, unsigned int level)
+{
+   return pCube->getName() + "_Level_" + StringUtilities::toDisplayString(level);
+}
+
+RasterElement* Tutorial6::getLevel(RasterElement* pCube, unsigned int level, Progress* pProgress)
+{
+   //level 0 is the cube itself, missing levels are built on demand without rebuilding the ones already there
+   if (pCube == NULL || level == 0)
+   {
+      return pCube;
+   }
+
+   Service<ModelServices> pModel;
+   std::string name = getLevelName(pCube, level);
+   RasterElement* pLevel = static_cast<RasterElement*>(pModel->getElement(name,
+      TypeConverter::toString<RasterElement>(), pCube));
+   if (pLevel == NULL)
+   {
+      ExecutableResource pBuild("Tutorial 6", std::string(), pProgress, true);
+      VERIFYRV(pBuild->getPlugIn() != NULL, NULL);
+      pBuild->getInArgList().setPlugInArgValue(Executable::DataElementArg(), pCube);
+      pBuild->getInArgList().setPlugInArgValue("Levels", &level);
+      bool keepExisting = true;
+      pBuild->getInArgList().setPlugInArgValue("Keep Existing Levels", &keepExisting);
+      if (pBuild->execute())
+      {
+         pLevel = static_cast<RasterElement*>(pModel->getElement(name, TypeConverter::toString<RasterElement>(), pCube));
+      }
+   }
+   return pLevel;
+}
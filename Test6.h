@@ -0,0 +1,33 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef TUTORIAL6_H
+#define TUTORIAL6_H
+
+#include "ExecutableShell.h"
+#include <string>
+
+class Progress;
+class RasterElement;
+
+class Tutorial6 : public ExecutableShell
+{
+public:
+   Tutorial6();
+   virtual ~Tutorial6();
+
+   virtual bool getInputSpecification(PlugInArgList*& pInArgList);
+   virtual bool getOutputSpecification(PlugInArgList*& pOutArgList);
+   virtual bool execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList);
+
+   static std::string getLevelName(const RasterElement* pCube, unsigned int level);
+   static RasterElement* getLevel(RasterElement* pCube, unsigned int level, Progress* pProgress);
+};
+
+#endif
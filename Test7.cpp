@@ -0,0 +1,577 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "AppVerify.h"
+#include "BatchKernel.h"
+#include "DataVariant.h"
+#include "DesktopServices.h"
+#include "Executable.h"
+#include "MessageLogResource.h"
+#include "ModelServices.h"
+#include "PlugInArg.h"
+#include "PlugInArgList.h"
+#include "PlugInManagerServices.h"
+#include "PlugInRegistration.h"
+#include "PlugInResource.h"
+#include "Progress.h"
+#include "RasterDataDescriptor.h"
+#include "RasterElement.h"
+#include "StepLog.h"
+#include "StringUtilities.h"
+#include "Test7.h"
+#include "TypeConverter.h"
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
+#include <QtGui/QInputDialog>
+#include <algorithm>
+#include <memory>
+#include <set>
+#include <vector>
+
+REGISTER_PLUGIN_BASIC(OpticksTutorial, Tutorial7);
+
+namespace
+{
+   //One operation on one raster element. The executable is created, and the operation prepared and finished, on
+   //the calling thread, so the pool threads only ever run the operation's kernel.
+   struct BatchJob
+   {
+      BatchJob(RasterElement* pCube, const std::string& operation) :
+         mpCube(pCube),
+         mOperation(operation),
+         mExecutable(operation, std::string(), NULL, true),
+         mpBatchOperation(NULL),
+         mSize(0),
+         mMemory(0),
+         mSuccess(false)
+      {
+      }
+
+      RasterElement* mpCube;
+      std::string mOperation;
+      std::string mKey; //jobs with the same key write the same output, so only one runs at a time
+      ExecutableResource mExecutable;
+      BatchOperation* mpBatchOperation; //NULL if the operation can only be executed as a whole
+      std::auto_ptr<BatchKernel> mpKernel;
+      unsigned long long mSize;
+      unsigned long long mMemory;
+      bool mSuccess;
+   };
+
+   bool isLarger(const BatchJob* pLeft, const BatchJob* pRight)
+   {
+      return pLeft->mSize > pRight->mSize;
+   }
+
+   //rough working memory of one job beyond the source cube, from what each tutorial allocates
+   unsigned long long getJobMemory(const std::string& operation, const RasterDataDescriptor* pDesc)
+   {
+      unsigned long long rowBytes = static_cast<unsigned long long>(pDesc->getColumnCount()) *
+         pDesc->getBytesPerElement();
+      unsigned long long bandBytes = rowBytes * pDesc->getRowCount();
+      unsigned long long readAhead = 2 * 64 * rowBytes; //the default read ahead ring
+      if (operation == "Tutorial 3")
+      {
+         //a read ahead ring and a 16 bit histogram for its one strip thread
+         return readAhead + 65536 * sizeof(unsigned int);
+      }
+      if (operation == "Tutorial 4")
+      {
+         return readAhead;
+      }
+      if (operation == "Tutorial 5")
+      {
+         //the result element and the three row window
+         return readAhead + bandBytes + 3 * pDesc->getColumnCount() * sizeof(double);
+      }
+      if (operation == "Tutorial 6")
+      {
+         //the levels add up to a third of a band, plus double sums for two rows of each level
+         return readAhead + bandBytes / 3 + 4 * pDesc->getColumnCount() * sizeof(double);
+      }
+      return readAhead + bandBytes;
+   }
+
+   //Jobs are only started once their memory fits. A job larger than the whole budget still starts once nothing
+   //else is running, rather than never. Only the calling thread starts and finishes jobs, so there is no locking.
+   class MemoryBudget
+   {
+   public:
+      MemoryBudget(unsigned long long limit) :
+         mLimit(limit),
+         mInUse(0)
+      {
+      }
+
+      bool reserve(unsigned long long bytes)
+      {
+         if (mLimit > 0 && mInUse > 0 && mInUse + bytes > mLimit)
+         {
+            return false;
+         }
+         mInUse += bytes;
+         return true;
+      }
+
+      void release(unsigned long long bytes)
+      {
+         mInUse -= bytes;
+      }
+
+   private:
+      unsigned long long mLimit;
+      unsigned long long mInUse;
+   };
+
+   //Holds the prepared jobs in the order they were posted. Every idle thread claims the next one through the
+   //shared index, so no thread sits on jobs while another has run out, and collects the computed ones for the
+   //calling thread to finish.
+   class JobBoard
+   {
+   public:
+      JobBoard() :
+         mNextJob(0),
+         mClosed(false)
+      {
+      }
+
+      void post(BatchJob* pJob)
+      {
+         QMutexLocker lock(&mMutex);
+         mPosted.push_back(pJob);
+         mPostedChanged.wakeOne();
+      }
+
+      //the next posted job for the calling thread to compute, waiting for one to be posted, NULL once closed
+      BatchJob* claim()
+      {
+         QMutexLocker lock(&mMutex);
+         while (mNextJob == mPosted.size() && !mClosed)
+         {
+            mPostedChanged.wait(&mMutex);
+         }
+         if (mNextJob == mPosted.size())
+         {
+            return NULL;
+         }
+         return mPosted[mNextJob++];
+      }
+
+      void computed(BatchJob* pJob)
+      {
+         QMutexLocker lock(&mMutex);
+         mComputed.push_back(pJob);
+         mDone.wakeAll();
+      }
+
+      //the jobs computed since the last call, waiting up to time milliseconds for one if there are none
+      std::vector<BatchJob*> takeComputed(unsigned long time)
+      {
+         QMutexLocker lock(&mMutex);
+         if (mComputed.empty() && time > 0)
+         {
+            mDone.wait(&mMutex, time);
+         }
+         std::vector<BatchJob*> jobs;
+         jobs.swap(mComputed);
+         return jobs;
+      }
+
+      void close()
+      {
+         QMutexLocker lock(&mMutex);
+         mClosed = true;
+         mPostedChanged.wakeAll();
+      }
+
+   private:
+      QMutex mMutex;
+      QWaitCondition mPostedChanged;
+      QWaitCondition mDone;
+      std::vector<BatchJob*> mPosted;
+      std::vector<BatchJob*>::size_type mNextJob; //the first posted job no thread has claimed yet
+      bool mClosed;
+      std::vector<BatchJob*> mComputed;
+   };
+
+   class BatchThread : public QThread
+   {
+   public:
+      BatchThread(JobBoard& board, QAtomicInt& aborted) :
+         mBoard(board),
+         mAborted(aborted)
+      {
+      }
+
+   protected:
+      virtual void run()
+      {
+         for (BatchJob* pJob = mBoard.claim(); pJob != NULL; pJob = mBoard.claim())
+         {
+            pJob->mpKernel->compute(mAborted);
+            mBoard.computed(pJob);
+         }
+      }
+
+   private:
+      JobBoard& mBoard;
+      QAtomicInt& mAborted;
+   };
+
+   //owns the jobs and threads so every return path cleans them up
+   struct BatchPool
+   {
+      ~BatchPool()
+      {
+         mBoard.close();
+         for (std::vector<BatchThread*>::iterator it = mThreads.begin(); it != mThreads.end(); ++it)
+         {
+            (*it)->wait();
+            delete *it;
+         }
+         for (std::vector<BatchJob*>::iterator it = mJobs.begin(); it != mJobs.end(); ++it)
+         {
+            delete *it;
+         }
+      }
+
+      std::vector<BatchJob*> mJobs;
+      std::vector<BatchThread*> mThreads;
+      JobBoard mBoard;
+   };
+
+   std::string getValueText(PlugInArg* pArg)
+   {
+      if (Service<ModelServices>()->isKindOfElement(pArg->getType(), "DataElement"))
+      {
+         DataElement* pElement = reinterpret_cast<DataElement*>(pArg->getActualValue());
+         return (pElement == NULL) ? std::string() : pElement->getName();
+      }
+      return DataVariant(pArg->getType(), pArg->getActualValue(), false).toDisplayString();
+   }
+
+   std::string getResultRow(const std::string& element, const std::string& operation, const std::string& output,
+      const std::string& value)
+   {
+      return element + "\t" + operation + "\t" + output + "\t" + value;
+   }
+}
+
+Tutorial7::Tutorial7()
+{
+   setDescriptorId("{C41E7B90-2F6D-4A83-9B15-7E0D3A68F2C4}");
+   setName("Tutorial 7");
+   setDescription("Running tutorial operations over many raster elements.");
+   setCreator("Opticks Community");
+   setVersion("Sample");
+   setCopyright("Copyright (C) 2008, Ball Aerospace & Technologies Corp.");
+   setProductionStatus(false);
+   setType("Sample");
+   setSubtype("Batch");
+   setMenuLocation("[Tutorial]/Tutorial 7");
+   setAbortSupported(true);
+}
+
+Tutorial7::~Tutorial7()
+{
+}
+
+bool Tutorial7::getInputSpecification(PlugInArgList*& pInArgList)
+{
+   VERIFY(pInArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pInArgList->addArg<Progress>(Executable::ProgressArg(), NULL, "Progress reporter");
+   pInArgList->addArg<std::vector<RasterElement*> >("Raster Elements", "Run the operations on each of these raster elements");
+   pInArgList->addArg<std::vector<std::string> >("Filenames", "Import these files and run the operations on each raster element imported");
+   std::vector<std::string> operations;
+   operations.push_back("Tutorial 3");
+   pInArgList->addArg<std::vector<std::string> >("Operations", operations, "Names of the plug-ins to run on each raster element, "
+      "for example Tutorial 3, Tutorial 4 or Tutorial 5. Each gets the raster element as its data element and default values for its other inputs.");
+   pInArgList->addArg<unsigned int>("Thread Count", 0, "Number of operations to run at once. 0 uses one per processor.");
+   pInArgList->addArg<unsigned int>("Memory Budget", 1024, "Megabytes of working memory the running operations may use together. 0 is unlimited.");
+   return true;
+}
+
+bool Tutorial7::getOutputSpecification(PlugInArgList*& pOutArgList)
+{
+   VERIFY(pOutArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pOutArgList->addArg<std::vector<std::string> >("Results", "One tab separated row of element, operation, output and value "
+      "for each output of each operation, after a header row. Every operation also has a Succeeded row.");
+   pOutArgList->addArg<unsigned int>("Failures", "The number of imports and operations which failed");
+   return true;
+}
+
+bool Tutorial7::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
+{
+   DeferredStepResource pStep("Tutorial 7", "app", "8B2F6C1D-5E94-4A07-B3D8-61C0F7E94A25");
+   if (pInArgList == NULL || pOutArgList == NULL)
+   {
+      return false;
+   }
+   Progress* pProgress = pInArgList->getPlugInArgValue<Progress>(Executable::ProgressArg());
+
+   std::vector<RasterElement*> cubes;
+   std::vector<std::string> filenames;
+   std::vector<std::string> operations;
+   unsigned int threadCount = 0;
+   unsigned int memoryBudget = 0;
+   pInArgList->getPlugInArgValue("Raster Elements", cubes);
+   pInArgList->getPlugInArgValue("Filenames", filenames);
+   pInArgList->getPlugInArgValue("Operations", operations);
+   pInArgList->getPlugInArgValue("Thread Count", threadCount);
+   pInArgList->getPlugInArgValue("Memory Budget", memoryBudget);
+   cubes.erase(std::remove(cubes.begin(), cubes.end(), static_cast<RasterElement*>(NULL)), cubes.end());
+   if (!isBatch() && cubes.empty() && filenames.empty())
+   {
+      //run from the menu, so ask which of the loaded raster elements to process
+      std::vector<DataElement*> elements = Service<ModelServices>()->getElements(NULL,
+         TypeConverter::toString<RasterElement>());
+      if (!elements.empty())
+      {
+         QStringList cubeNames("<all>");
+         for (std::vector<DataElement*>::iterator it = elements.begin(); it != elements.end(); ++it)
+         {
+            cubeNames << QString::fromStdString((*it)->getName());
+         }
+
+         bool selected = false;
+         QString cubeName = QInputDialog::getItem(Service<DesktopServices>()->getMainWidget(),
+            "Select a raster element", "Select the raster element to process", cubeNames, 0, false, &selected);
+         for (std::vector<DataElement*>::iterator it = elements.begin(); selected && it != elements.end(); ++it)
+         {
+            if (cubeName == "<all>" || (*it)->getName() == cubeName.toStdString())
+            {
+               cubes.push_back(static_cast<RasterElement*>(*it));
+            }
+         }
+      }
+   }
+
+   std::vector<std::string> results;
+   results.push_back(getResultRow("Element", "Operation", "Output", "Value"));
+   unsigned int failures = 0;
+
+   //importers are not run on the pool, they are plug-ins with their own progress and may need the main thread
+   for (unsigned int file = 0; file < filenames.size(); ++file)
+   {
+      if (isAborted())
+      {
+         break;
+      }
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress("Importing " + filenames[file], 0, NORMAL);
+      }
+
+      ImporterResource pImporter("Auto Importer", filenames[file], pProgress, true);
+      bool imported = pImporter->execute();
+      if (imported)
+      {
+         std::vector<DataElement*> elements = pImporter->getImportedElements();
+         for (std::vector<DataElement*>::iterator it = elements.begin(); it != elements.end(); ++it)
+         {
+            RasterElement* pCube = dynamic_cast<RasterElement*>(*it);
+            if (pCube != NULL)
+            {
+               cubes.push_back(pCube);
+            }
+         }
+      }
+      else
+      {
+         ++failures;
+      }
+      results.push_back(getResultRow(filenames[file], "Import", "Succeeded", StringUtilities::toDisplayString(imported)));
+   }
+
+   if (cubes.empty() || operations.empty())
+   {
+      std::string msg = cubes.empty() ? "There are no raster elements to process." : "No operations were specified.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+
+      return false;
+   }
+
+   BatchPool pool;
+   for (std::vector<RasterElement*>::iterator cube = cubes.begin(); cube != cubes.end(); ++cube)
+   {
+      const RasterDataDescriptor* pDesc = static_cast<const RasterDataDescriptor*>((*cube)->getDataDescriptor());
+      VERIFY(pDesc != NULL);
+      for (std::vector<std::string>::iterator operation = operations.begin(); operation != operations.end(); ++operation)
+      {
+         BatchJob* pJob = new BatchJob(*cube, *operation);
+         pool.mJobs.push_back(pJob);
+         Executable* pExecutable = dynamic_cast<Executable*>(pJob->mExecutable->getPlugIn());
+         if (pExecutable == NULL)
+         {
+            std::string msg = "The operation " + *operation + " is not available.";
+            pStep->finalize(Message::Failure, msg);
+            if (pProgress != NULL)
+            {
+               pProgress->updateProgress(msg, 0, ERRORS);
+            }
+
+            return false;
+         }
+         pExecutable->setBatch(); //prepareBatch() does not go through ExecutableResource::execute(), which sets it
+         pJob->mpBatchOperation = dynamic_cast<BatchOperation*>(pExecutable);
+         pJob->mExecutable->getInArgList().setPlugInArgValue(Executable::DataElementArg(), *cube);
+
+         //the pool already runs one job per thread, so a job does not start threads of its own
+         PlugInArg* pThreadCountArg = NULL;
+         if (pJob->mExecutable->getInArgList().getArg("Thread Count", pThreadCountArg) && pThreadCountArg != NULL)
+         {
+            unsigned int oneThread = 1;
+            pJob->mExecutable->getInArgList().setPlugInArgValue("Thread Count", &oneThread);
+         }
+         pJob->mKey = *operation + "\t" + (*cube)->getName();
+         pJob->mSize = static_cast<unsigned long long>(pDesc->getRowCount()) * pDesc->getColumnCount() *
+            pDesc->getBandCount() * pDesc->getBytesPerElement();
+         pJob->mMemory = getJobMemory(*operation, pDesc);
+      }
+   }
+
+   //Posting the largest jobs first leaves the small ones for the end, when they fill in around the last large
+   //ones, so a few large scenes do not hold up the end of the batch.
+   if (threadCount == 0)
+   {
+      threadCount = std::max(QThread::idealThreadCount(), 1);
+   }
+   threadCount = std::min(threadCount, static_cast<unsigned int>(pool.mJobs.size()));
+   std::vector<BatchJob*> waitingJobs(pool.mJobs);
+   std::stable_sort(waitingJobs.begin(), waitingJobs.end(), isLarger);
+   MemoryBudget budget(static_cast<unsigned long long>(memoryBudget) * 1024 * 1024);
+   QAtomicInt aborted(isAborted() ? 1 : 0);
+   for (unsigned int thread = 0; thread < threadCount; ++thread)
+   {
+      pool.mThreads.push_back(new BatchThread(pool.mBoard, aborted));
+      pool.mThreads.back()->start();
+   }
+
+   //Opticks services and the message log are only used from this thread, so the jobs are prepared and finished
+   //here and the pool threads only run their kernels. Up to two jobs per thread are prepared ahead, as their
+   //memory allows, and a job waits while another with the same output is running. Operations without a kernel
+   //are executed whole, here. An abort stops jobs from starting, the running ones are finished once they stop.
+   std::set<std::string> runningKeys;
+   unsigned int maxRunning = 2 * threadCount;
+   unsigned int running = 0;
+   unsigned int jobsDone = 0;
+   while (running > 0 || (aborted == 0 && !waitingJobs.empty()))
+   {
+      for (std::vector<BatchJob*>::iterator it = waitingJobs.begin();
+         it != waitingJobs.end() && aborted == 0 && running < maxRunning;)
+      {
+         BatchJob* pJob = *it;
+         if (runningKeys.count(pJob->mKey) > 0 || !budget.reserve(pJob->mMemory))
+         {
+            ++it;
+            continue;
+         }
+         it = waitingJobs.erase(it);
+
+         if (pJob->mpBatchOperation != NULL)
+         {
+            pJob->mpKernel.reset(pJob->mpBatchOperation->prepareBatch(&pJob->mExecutable->getInArgList()));
+            if (pJob->mpKernel.get() != NULL)
+            {
+               runningKeys.insert(pJob->mKey);
+               ++running;
+               pool.mBoard.post(pJob);
+               continue;
+            }
+         }
+         else
+         {
+            pJob->mSuccess = pJob->mExecutable->execute();
+         }
+         budget.release(pJob->mMemory);
+         ++jobsDone;
+      }
+
+      std::vector<BatchJob*> computed = pool.mBoard.takeComputed(running > 0 ? 100 : 0);
+      for (std::vector<BatchJob*>::iterator it = computed.begin(); it != computed.end(); ++it)
+      {
+         BatchJob* pJob = *it;
+         pJob->mSuccess = pJob->mpBatchOperation->finishBatch(pJob->mpKernel.get(),
+            &pJob->mExecutable->getOutArgList());
+         pJob->mpKernel.reset();
+         budget.release(pJob->mMemory);
+         runningKeys.erase(pJob->mKey);
+         --running;
+         ++jobsDone;
+      }
+
+      if (isAborted())
+      {
+         aborted = 1;
+      }
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress("Running batch operations", static_cast<int>(jobsDone * 100 / pool.mJobs.size()),
+            NORMAL);
+      }
+   }
+   if (aborted != 0)
+   {
+      std::string msg = getName() + " has been aborted.";
+      pStep->finalize(Message::Abort, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ABORT);
+      }
+
+      return false;
+   }
+
+   for (std::vector<BatchJob*>::iterator it = pool.mJobs.begin(); it != pool.mJobs.end(); ++it)
+   {
+      BatchJob* pJob = *it;
+      std::string element = pJob->mpCube->getName();
+      results.push_back(getResultRow(element, pJob->mOperation, "Succeeded",
+         StringUtilities::toDisplayString(pJob->mSuccess)));
+      if (!pJob->mSuccess)
+      {
+         ++failures;
+         continue;
+      }
+
+      PlugInArgList& outArgs = pJob->mExecutable->getOutArgList();
+      for (unsigned short index = 0; index < outArgs.getCount(); ++index)
+      {
+         PlugInArg* pArg = NULL;
+         if (outArgs.getArg(index, pArg) && pArg != NULL && pArg->isActualSet())
+         {
+            results.push_back(getResultRow(element, pJob->mOperation, pArg->getName(), getValueText(pArg)));
+         }
+      }
+   }
+
+   if (pProgress != NULL)
+   {
+      std::string msg = "Ran " + StringUtilities::toDisplayString(static_cast<unsigned int>(pool.mJobs.size())) + " operations";
+      if (failures > 0)
+      {
+         msg += ", " + StringUtilities::toDisplayString(failures) + " failed";
+      }
+      pProgress->updateProgress(msg + ".", 100, (failures > 0) ? WARNING : NORMAL);
+   }
+
+   pOutArgList->setPlugInArgValue("Results", &results);
+   pOutArgList->setPlugInArgValue("Failures", &failures);
+
+   pStep->finalize();
+   return true;
+}
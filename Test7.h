@@ -0,0 +1,26 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef TUTORIAL7_H
+#define TUTORIAL7_H
+
+#include "ExecutableShell.h"
+
+class Tutorial7 : public ExecutableShell
+{
+public:
+   Tutorial7();
+   virtual ~Tutorial7();
+
+   virtual bool getInputSpecification(PlugInArgList*& pInArgList);
+   virtual bool getOutputSpecification(PlugInArgList*& pOutArgList);
+   virtual bool execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList);
+};
+
+#endif
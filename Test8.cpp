@@ -0,0 +1,272 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "AppVerify.h"
+#include "BadValueMask.h"
+#include "BandMath.h"
+#include "DesktopServices.h"
+#include "MessageLogResource.h"
+#include "ObjectResource.h"
+#include "PlugInArgList.h"
+#include "PlugInManagerServices.h"
+#include "PlugInRegistration.h"
+#include "Progress.h"
+#include "RasterDataDescriptor.h"
+#include "RasterElement.h"
+#include "RasterUtilities.h"
+#include "RowReader.h"
+#include "RowWriter.h"
+#include "SpatialDataView.h"
+#include "SpatialDataWindow.h"
+#include "StepLog.h"
+#include "switchOnEncoding.h"
+#include "Test8.h"
+#include <QtGui/QInputDialog>
+#include <QtGui/QLineEdit>
+#include <memory>
+#include <vector>
+
+REGISTER_PLUGIN_BASIC(OpticksTutorial, Tutorial8);
+
+namespace
+{
+   template<typename T>
+   void writeValues(T* pData, const double* pValues, unsigned int columnCount)
+   {
+      for (unsigned int col = 0; col < columnCount; ++col)
+      {
+         pData[col] = static_cast<T>(pValues[col]);
+      }
+   }
+}
+
+Tutorial8::Tutorial8()
+{
+   setDescriptorId("{9E5A7C13-48D2-4B6F-A0E1-3C7B52F8D914}");
+   setName("Tutorial 8");
+   setDescription("Calculating a band math expression of the bands of a raster element.");
+   setCreator("Opticks Community");
+   setVersion("Sample");
+   setCopyright("Copyright (C) 2008, Ball Aerospace & Technologies Corp.");
+   setProductionStatus(false);
+   setType("Sample");
+   setSubtype("Band Math");
+   setMenuLocation("[Tutorial]/Tutorial 8");
+   setAbortSupported(true);
+}
+
+Tutorial8::~Tutorial8()
+{
+}
+
+bool Tutorial8::getInputSpecification(PlugInArgList*& pInArgList)
+{
+   VERIFY(pInArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pInArgList->addArg<Progress>(Executable::ProgressArg(), NULL, "Progress reporter");
+   pInArgList->addArg<RasterElement>(Executable::DataElementArg(), "Calculate the expression over the bands of this raster element");
+   pInArgList->addArg<std::string>("Expression", "The expression to calculate for each pixel, such as (b4 - b3) / (b4 + b3). "
+      "Bands are b1, b2 and so on, with + - * / ^, parentheses and sqrt, abs, log, exp, min and max. Tutorial 3 takes the same "
+      "expressions to generate statistics without a result raster element. Asked for when it is not set and Tutorial 8 "
+      "is run from the menu.");
+   pInArgList->addArg<double>("No Data Value", "Band samples with this value are treated as bad values, along with the bad values of the raster element");
+   pInArgList->addArg<std::string>("Output Type", std::string("FLT4"), "Data type of the result, FLT4 or FLT8. Pixels where the "
+      "expression uses a bad value are NaN.");
+   pInArgList->addArg<std::string>("Output File", std::string(), "Write the result straight into this raw file, with an ENVI "
+      "header beside it, instead of a raster element");
+   RowReader::addReadAheadArgs(pInArgList);
+   return true;
+}
+
+bool Tutorial8::getOutputSpecification(PlugInArgList*& pOutArgList)
+{
+   VERIFY(pOutArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pOutArgList->addArg<RasterElement>("Result", NULL);
+   return true;
+}
+
+bool Tutorial8::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
+{
+   DeferredStepResource pStep("Tutorial 8", "app", "E27D4B90-6C15-4F83-9A2E-71B0C5D38F64");
+   if (pInArgList == NULL || pOutArgList == NULL)
+   {
+      return false;
+   }
+   Progress* pProgress = pInArgList->getPlugInArgValue<Progress>(Executable::ProgressArg());
+   RasterElement* pCube = pInArgList->getPlugInArgValue<RasterElement>(Executable::DataElementArg());
+   if (pCube == NULL)
+   {
+      std::string msg = "A raster cube must be specified.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   RasterDataDescriptor* pDesc = static_cast<RasterDataDescriptor*>(pCube->getDataDescriptor());
+   VERIFY(pDesc != NULL);
+
+   std::string expressionText;
+   bool haveExpression = pInArgList->getPlugInArgValue("Expression", expressionText);
+   if (!haveExpression && !isBatch())
+   {
+      bool entered = false;
+      QString text = QInputDialog::getText(Service<DesktopServices>()->getMainWidget(), "Enter an expression",
+         "Enter the expression to calculate, such as (b4 - b3) / (b4 + b3)", QLineEdit::Normal, QString(), &entered);
+      expressionText = text.toStdString();
+      haveExpression = entered && !expressionText.empty();
+   }
+   std::string error = "An expression must be specified.";
+   BandMathExpression expression;
+   if (!haveExpression || !expression.compile(expressionText, pDesc->getBandCount(), error))
+   {
+      std::string msg = "The expression is not valid. " + error;
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   pStep->addProperty("Expression", expressionText);
+
+   std::string outputType = "FLT4";
+   pInArgList->getPlugInArgValue("Output Type", outputType);
+   if (outputType != "FLT4" && outputType != "FLT8")
+   {
+      std::string msg = "The output type must be FLT4 or FLT8.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   EncodingType resultType = (outputType == "FLT8") ? FLT8BYTES : FLT4BYTES;
+
+   double noDataValue = 0.0;
+   bool hasNoDataValue = pInArgList->getPlugInArgValue("No Data Value", noDataValue);
+   BadValueMask mask(pDesc, hasNoDataValue ? &noDataValue : NULL);
+
+   unsigned int readAheadRows = 0;
+   unsigned int readAheadDepth = 0;
+   RowReader::getReadAheadArgs(pInArgList, readAheadRows, readAheadDepth);
+
+   std::string outputFile;
+   pInArgList->getPlugInArgValue("Output File", outputFile);
+   bool toFile = !outputFile.empty();
+   unsigned int rowCount = pDesc->getRowCount();
+   unsigned int columnCount = pDesc->getColumnCount();
+   //the results of earlier runs are kept, each run gets a name of its own
+   std::string resultName = toFile ? std::string() : RowWriter::getUnusedElementName(pCube->getName() + "_Band_Math");
+   ModelResource<RasterElement> pResultCube(toFile ? NULL :
+      RasterUtilities::createRasterElement(resultName, rowCount, columnCount, resultType));
+   std::auto_ptr<RowWriter> pWriter;
+   if (toFile)
+   {
+      pWriter.reset(new RowWriter(outputFile, rowCount, columnCount, resultType));
+   }
+   else if (pResultCube.get() != NULL)
+   {
+      pWriter.reset(new RowWriter(pResultCube.get()));
+   }
+   if (pWriter.get() == NULL || !pWriter->isValid())
+   {
+      std::string msg = toFile ? "Unable to create the output file " + outputFile + "." :
+         "A raster cube could not be created.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+
+   //Only the bands the expression uses are read, and each row is calculated in one pass over them straight into
+   //the result.
+   BandRowReaders readers(pCube, expression.getBands(), 0, rowCount - 1, readAheadRows, readAheadDepth);
+   BandMathExpression::Rows rows;
+   for (unsigned int row = 0; row < rowCount; ++row)
+   {
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress("Calculating result", row * 100 / rowCount, NORMAL);
+      }
+      if (isAborted())
+      {
+         std::string msg = getName() + " has been aborted.";
+         pStep->finalize(Message::Abort, msg);
+         if (pProgress != NULL)
+         {
+            pProgress->updateProgress(msg, 0, ABORT);
+         }
+         return false;
+      }
+      if (!readers.isValid() || !pWriter->isValid())
+      {
+         std::string msg = "Unable to access the cube data.";
+         pStep->finalize(Message::Failure, msg);
+         if (pProgress != NULL)
+         {
+            pProgress->updateProgress(msg, 0, ERRORS);
+         }
+         return false;
+      }
+
+      const double* pValues = expression.evaluate(pDesc->getDataType(), readers.getRows(), columnCount, mask, rows);
+      switchOnEncoding(resultType, writeValues, pWriter->getRow(), pValues, columnCount);
+      pWriter->nextRow();
+      readers.nextRow();
+   }
+   //an output file is only kept, with its header, once every row is written
+   if (!pWriter->finish())
+   {
+      std::string msg = "Unable to write the output file " + outputFile + ".";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+      return false;
+   }
+   pWriter.reset();
+
+   if (!toFile)
+   {
+      RasterElement* pResult = pResultCube.get();
+      if (!isBatch())
+      {
+         Service<DesktopServices> pDesktop;
+         SpatialDataWindow* pWindow = static_cast<SpatialDataWindow*>(pDesktop->createWindow(pResult->getName(),
+            SPATIAL_DATA_WINDOW));
+         SpatialDataView* pView = (pWindow == NULL) ? NULL : pWindow->getSpatialDataView();
+         if (pView == NULL)
+         {
+            std::string msg = "Unable to create view.";
+            pStep->finalize(Message::Failure, msg);
+            if (pProgress != NULL)
+            {
+               pProgress->updateProgress(msg, 0, ERRORS);
+            }
+            return false;
+         }
+         pView->setPrimaryRasterElement(pResult);
+         pView->createLayer(RASTER, pResult);
+      }
+      pResultCube.release();
+      pOutArgList->setPlugInArgValue("Result", pResult);
+   }
+
+   if (pProgress != NULL)
+   {
+      pProgress->updateProgress("Tutorial 8 is complete.", 100, NORMAL);
+   }
+   pStep->finalize();
+   return true;
+}
@@ -0,0 +1,26 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef TUTORIAL8_H
+#define TUTORIAL8_H
+
+#include "ExecutableShell.h"
+
+class Tutorial8 : public ExecutableShell
+{
+public:
+   Tutorial8();
+   virtual ~Tutorial8();
+
+   virtual bool getInputSpecification(PlugInArgList*& pInArgList);
+   virtual bool getOutputSpecification(PlugInArgList*& pOutArgList);
+   virtual bool execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList);
+};
+
+#endif
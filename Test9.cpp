@@ -0,0 +1,447 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "AppVerify.h"
+#include "BadValueMask.h"
+#include "MessageLogResource.h"
+#include "PlugInArgList.h"
+#include "PlugInManagerServices.h"
+#include "PlugInRegistration.h"
+#include "Progress.h"
+#include "RasterDataDescriptor.h"
+#include "RasterElement.h"
+#include "RowReader.h"
+#include "RowStripWorker.h"
+#include "StepLog.h"
+#include "StringUtilities.h"
+#include "switchOnEncoding.h"
+#include "Test9.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+REGISTER_PLUGIN_BASIC(OpticksTutorial, Tutorial9);
+
+namespace
+{
+   //spectra gathered before each rank-k update of the cross products
+   const unsigned int sBlockPixels = 64;
+
+   //square tile of the cross product matrix kept in cache while a block streams past it
+   const unsigned int sTileBands = 32;
+
+   //Adds the outer products of a block of spectra, one per row of pBlock, to the upper triangle of pCross. Each
+   //tile is finished for the whole block before moving on, and the innermost loop runs along contiguous rows of both
+   //the block and the matrix so the compiler can vectorize it.
+   void addOuterProducts(const double* pBlock, unsigned int pixelCount, unsigned int bandCount, double* pCross)
+   {
+      for (unsigned int rowStart = 0; rowStart < bandCount; rowStart += sTileBands)
+      {
+         unsigned int rowEnd = std::min(rowStart + sTileBands, bandCount);
+         for (unsigned int colStart = rowStart; colStart < bandCount; colStart += sTileBands)
+         {
+            unsigned int colEnd = std::min(colStart + sTileBands, bandCount);
+            for (unsigned int pixel = 0; pixel < pixelCount; ++pixel)
+            {
+               const double* pSpectrum = pBlock + static_cast<size_t>(pixel) * bandCount;
+               for (unsigned int band = rowStart; band < rowEnd; ++band)
+               {
+                  const double value = pSpectrum[band];
+                  double* pCrossRow = pCross + static_cast<size_t>(band) * bandCount;
+                  for (unsigned int other = std::max(band, colStart); other < colEnd; ++other)
+                  {
+                     pCrossRow[other] += value * pSpectrum[other];
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   //The count, mean and scatter (sum of outer products about the mean, upper triangle) of a set of spectra. The mean
+   //is kept as a shift, one of the spectra, plus the small offset from it, so the difference of two large means is
+   //taken exactly when they are merged.
+   struct SpectralMoments
+   {
+      SpectralMoments(unsigned int bandCount) :
+         mCount(0),
+         mShift(bandCount, 0.0),
+         mOffsets(bandCount, 0.0),
+         mScatter(static_cast<size_t>(bandCount) * bandCount, 0.0)
+      {
+      }
+
+      std::vector<double> getMeans() const
+      {
+         std::vector<double> means(mShift);
+         for (unsigned int band = 0; band < means.size(); ++band)
+         {
+            means[band] += mOffsets[band];
+         }
+         return means;
+      }
+
+      //pairwise combination, so strips are merged without going back to raw sums
+      void merge(const SpectralMoments& other)
+      {
+         if (other.mCount == 0)
+         {
+            return;
+         }
+         if (mCount == 0)
+         {
+            *this = other;
+            return;
+         }
+
+         unsigned int bandCount = mShift.size();
+         double total = static_cast<double>(mCount) + other.mCount;
+         double weight = static_cast<double>(mCount) * other.mCount / total;
+         std::vector<double> delta(bandCount);
+         for (unsigned int band = 0; band < bandCount; ++band)
+         {
+            delta[band] = (other.mShift[band] - mShift[band]) + (other.mOffsets[band] - mOffsets[band]);
+            mOffsets[band] += delta[band] * other.mCount / total;
+         }
+         for (unsigned int band = 0; band < bandCount; ++band)
+         {
+            double* pScatter = &mScatter[static_cast<size_t>(band) * bandCount];
+            const double* pOther = &other.mScatter[static_cast<size_t>(band) * bandCount];
+            for (unsigned int col = band; col < bandCount; ++col)
+            {
+               pScatter[col] += pOther[col] + delta[band] * delta[col] * weight;
+            }
+         }
+         mCount += other.mCount;
+      }
+
+      unsigned int mCount;
+      std::vector<double> mShift;
+      std::vector<double> mOffsets;
+      std::vector<double> mScatter;
+   };
+
+   class CovarianceWorker : public RowStripWorker
+   {
+   public:
+      CovarianceWorker(RasterElement* pCube, RowStripReaders& readers, unsigned int strip, QAtomicInt& rowsDone,
+         QAtomicInt& aborted, const BadValueMask& mask, InterleaveFormatType interleave) :
+         RowStripWorker(pCube, readers, strip, rowsDone, aborted),
+         mMask(mask),
+         mInterleave(interleave),
+         mBandCount(getDescriptor()->getBandCount()),
+         mBlock(static_cast<size_t>(sBlockPixels) * mBandCount),
+         mValid(sBlockPixels),
+         mCount(0),
+         mHaveShift(false),
+         mShift(mBandCount, 0.0),
+         mSums(mBandCount, 0.0),
+         mCross(static_cast<size_t>(mBandCount) * mBandCount, 0.0)
+      {
+      }
+
+      //fills the block with up to sBlockPixels spectra of the row from startColumn on, returning how many
+      template<typename T>
+      unsigned int fillBlock(const T* pData, unsigned int startColumn)
+      {
+         unsigned int columnCount = getColumnCount();
+         unsigned int pixelCount = std::min(sBlockPixels, columnCount - startColumn);
+         std::fill(mValid.begin(), mValid.begin() + pixelCount, 1);
+         if (mInterleave == BIP)
+         {
+            const T* pSpectrum = pData + static_cast<size_t>(startColumn) * mBandCount;
+            for (unsigned int pixel = 0; pixel < pixelCount; ++pixel, pSpectrum += mBandCount)
+            {
+               double* pBlock = &mBlock[static_cast<size_t>(pixel) * mBandCount];
+               for (unsigned int band = 0; band < mBandCount; ++band)
+               {
+                  pBlock[band] = static_cast<double>(pSpectrum[band]);
+                  mValid[pixel] &= mMask.isValid(pBlock[band]);
+               }
+            }
+         }
+         else
+         {
+            //BIL rows hold each band's samples together, so the block is filled a band at a time
+            for (unsigned int band = 0; band < mBandCount; ++band)
+            {
+               const T* pBand = pData + static_cast<size_t>(band) * columnCount + startColumn;
+               for (unsigned int pixel = 0; pixel < pixelCount; ++pixel)
+               {
+                  double value = static_cast<double>(pBand[pixel]);
+                  mBlock[static_cast<size_t>(pixel) * mBandCount + band] = value;
+                  mValid[pixel] &= mMask.isValid(value);
+               }
+            }
+         }
+         return pixelCount;
+      }
+
+      //Accumulates the filled block about the shift, the first valid spectrum seen, which keeps the cross products
+      //small enough to subtract the mean from without losing precision. Invalid spectra become zero.
+      void addBlock(unsigned int pixelCount)
+      {
+         for (unsigned int pixel = 0; pixel < pixelCount && !mHaveShift; ++pixel)
+         {
+            if (mValid[pixel] != 0)
+            {
+               std::copy(mBlock.begin() + static_cast<size_t>(pixel) * mBandCount,
+                  mBlock.begin() + static_cast<size_t>(pixel + 1) * mBandCount, mShift.begin());
+               mHaveShift = true;
+            }
+         }
+
+         for (unsigned int pixel = 0; pixel < pixelCount; ++pixel)
+         {
+            double* pSpectrum = &mBlock[static_cast<size_t>(pixel) * mBandCount];
+            bool valid = (mValid[pixel] != 0);
+            for (unsigned int band = 0; band < mBandCount; ++band)
+            {
+               pSpectrum[band] = valid ? pSpectrum[band] - mShift[band] : 0.0;
+               mSums[band] += pSpectrum[band];
+            }
+            mCount += valid;
+         }
+         addOuterProducts(&mBlock[0], pixelCount, mBandCount, &mCross[0]);
+      }
+
+      SpectralMoments getMoments() const
+      {
+         SpectralMoments moments(mBandCount);
+         moments.mCount = mCount;
+         if (mCount == 0)
+         {
+            return moments;
+         }
+         moments.mShift = mShift;
+         for (unsigned int band = 0; band < mBandCount; ++band)
+         {
+            moments.mOffsets[band] = mSums[band] / mCount;
+         }
+         for (unsigned int band = 0; band < mBandCount; ++band)
+         {
+            for (unsigned int col = band; col < mBandCount; ++col)
+            {
+               size_t index = static_cast<size_t>(band) * mBandCount + col;
+               moments.mScatter[index] = mCross[index] - mSums[band] * mSums[col] / mCount;
+            }
+         }
+         return moments;
+      }
+
+   protected:
+      virtual void processRow(void* pRow, unsigned int row);
+
+   private:
+      const BadValueMask& mMask;
+      InterleaveFormatType mInterleave;
+      unsigned int mBandCount;
+      std::vector<double> mBlock;
+      std::vector<unsigned char> mValid;
+      unsigned int mCount;
+      bool mHaveShift;
+      std::vector<double> mShift;
+      std::vector<double> mSums;
+      std::vector<double> mCross;
+   };
+
+   template<typename T>
+   void addRow(T* pData, CovarianceWorker& worker, unsigned int columnCount)
+   {
+      for (unsigned int column = 0; column < columnCount; )
+      {
+         unsigned int pixelCount = worker.fillBlock(pData, column);
+         worker.addBlock(pixelCount);
+         column += pixelCount;
+      }
+   }
+
+   void CovarianceWorker::processRow(void* pRow, unsigned int row)
+   {
+      switchOnEncoding(getDataType(), addRow, pRow, *this, getColumnCount());
+   }
+};
+
+Tutorial9::Tutorial9() :
+   mAborted(0)
+{
+   setDescriptorId("{3F81C6A2-D5E7-4B09-8C34-A1E6927B0F5D}");
+   setName("Tutorial 9");
+   setDescription("Calculating the band covariance and correlation matrices.");
+   setCreator("Opticks Community");
+   setVersion("Sample");
+   setCopyright("Copyright (C) 2008, Ball Aerospace & Technologies Corp.");
+   setProductionStatus(false);
+   setType("Sample");
+   setSubtype("Statistics");
+   setMenuLocation("[Tutorial]/Tutorial 9");
+   setAbortSupported(true);
+}
+
+Tutorial9::~Tutorial9()
+{
+}
+
+bool Tutorial9::getInputSpecification(PlugInArgList*& pInArgList)
+{
+   VERIFY(pInArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pInArgList->addArg<Progress>(Executable::ProgressArg(), NULL, "Progress reporter");
+   pInArgList->addArg<RasterElement>(Executable::DataElementArg(), "Calculate the band covariance of this raster element");
+   pInArgList->addArg<double>("No Data Value", "Pixels with this value in any band are excluded, along with those with a bad value of the raster element");
+   RowReader::addReadAheadArgs(pInArgList);
+   pInArgList->addArg<unsigned int>("Thread Count", 0, "Number of threads to calculate on. 0 uses one per processor.");
+   return true;
+}
+
+bool Tutorial9::getOutputSpecification(PlugInArgList*& pOutArgList)
+{
+   VERIFY(pOutArgList = Service<PlugInManagerServices>()->getPlugInArgList());
+   pOutArgList->addArg<unsigned int>("Count", "The number of pixels with valid values in every band");
+   pOutArgList->addArg<std::vector<double> >("Means", "The mean of each band");
+   pOutArgList->addArg<std::vector<double> >("Covariance", "The sample covariance matrix of the bands, row by row");
+   pOutArgList->addArg<std::vector<double> >("Correlation", "The correlation matrix of the bands, row by row. Bands "
+      "which do not vary have a correlation of 0 with the other bands.");
+   return true;
+}
+
+bool Tutorial9::execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList)
+{
+   DeferredStepResource pStep("Tutorial 9", "app", "B6E02F97-1A4C-4D85-9F3B-5C28E7D146A0");
+   if (pInArgList == NULL || pOutArgList == NULL)
+   {
+      return false;
+   }
+   Progress* pProgress = pInArgList->getPlugInArgValue<Progress>(Executable::ProgressArg());
+   RasterElement* pCube = pInArgList->getPlugInArgValue<RasterElement>(Executable::DataElementArg());
+   if (pCube == NULL)
+   {
+      std::string msg = "A raster cube must be specified.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+
+      return false;
+   }
+   RasterDataDescriptor* pDesc = static_cast<RasterDataDescriptor*>(pCube->getDataDescriptor());
+   VERIFY(pDesc != NULL);
+   if (pDesc->getDataType() == INT4SCOMPLEX || pDesc->getDataType() == FLT8COMPLEX)
+   {
+      std::string msg = "The covariance cannot be calculated for complex types.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+
+      return false;
+   }
+
+   double noDataValue = 0.0;
+   bool hasNoDataValue = pInArgList->getPlugInArgValue("No Data Value", noDataValue);
+   BadValueMask mask(pDesc, hasNoDataValue ? &noDataValue : NULL);
+   unsigned int readAheadRows = 0;
+   unsigned int readAheadDepth = 0;
+   RowReader::getReadAheadArgs(pInArgList, readAheadRows, readAheadDepth);
+   unsigned int threadCount = 0;
+   pInArgList->getPlugInArgValue("Thread Count", threadCount);
+
+   //Rows are read with every band, in the cube's own order when that is BIP or BIL so nothing is reordered. A BSQ
+   //cube has no contiguous spectra to offer, so the accessor gathers it into BIP.
+   InterleaveFormatType interleave = (pDesc->getInterleaveFormat() == BIL) ? BIL : BIP;
+   pStep->addProperty("Interleave", std::string(interleave == BIL ? "BIL" : "BIP"));
+
+   //Each strip keeps its own partial matrices, merged once all are done.
+   std::vector<unsigned int> strips = RowStripWorker::splitRows(pDesc->getRowCount(),
+      RowStripWorker::getThreadCount(pDesc->getRowCount(), threadCount));
+   RowStripReaders readers(pCube, strips, interleave, readAheadRows, readAheadDepth);
+   RowStripThreadGroup workers;
+   QAtomicInt rowsDone(0);
+   for (unsigned int strip = 0; strip < readers.getStripCount(); ++strip)
+   {
+      workers.addWorker(new CovarianceWorker(pCube, readers, strip, rowsDone, mAborted, mask, interleave));
+   }
+   if (!workers.run(rowsDone, pDesc->getRowCount(), mAborted, pProgress, "Calculating covariance", 0, 100))
+   {
+      std::string msg = (mAborted != 0) ? getName() + " has been aborted." : "Unable to access the cube data.";
+      pStep->finalize((mAborted != 0) ? Message::Abort : Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, (mAborted != 0) ? ABORT : ERRORS);
+      }
+
+      return false;
+   }
+
+   unsigned int bandCount = pDesc->getBandCount();
+   SpectralMoments moments(bandCount);
+   for (unsigned int worker = 0; worker < workers.getWorkerCount(); ++worker)
+   {
+      moments.merge(static_cast<CovarianceWorker*>(workers.getWorker(worker))->getMoments());
+   }
+   unsigned int count = moments.mCount;
+   if (count < 2)
+   {
+      std::string msg = "The covariance needs at least two pixels with valid values in every band.";
+      pStep->finalize(Message::Failure, msg);
+      if (pProgress != NULL)
+      {
+         pProgress->updateProgress(msg, 0, ERRORS);
+      }
+
+      return false;
+   }
+
+   std::vector<double> covariance(static_cast<size_t>(bandCount) * bandCount);
+   for (unsigned int band = 0; band < bandCount; ++band)
+   {
+      for (unsigned int col = band; col < bandCount; ++col)
+      {
+         double value = moments.mScatter[static_cast<size_t>(band) * bandCount + col] / (count - 1);
+         covariance[static_cast<size_t>(band) * bandCount + col] = value;
+         covariance[static_cast<size_t>(col) * bandCount + band] = value;
+      }
+   }
+   std::vector<double> correlation(covariance.size(), 0.0);
+   for (unsigned int band = 0; band < bandCount; ++band)
+   {
+      for (unsigned int col = 0; col < bandCount; ++col)
+      {
+         double variances = covariance[static_cast<size_t>(band) * bandCount + band] *
+            covariance[static_cast<size_t>(col) * bandCount + col];
+         double value = (variances > 0.0) ?
+            covariance[static_cast<size_t>(band) * bandCount + col] / std::sqrt(variances) : 0.0;
+         correlation[static_cast<size_t>(band) * bandCount + col] = (band == col) ? 1.0 : value;
+      }
+   }
+
+   if (pProgress != NULL)
+   {
+      pProgress->updateProgress("Covariance of " + StringUtilities::toDisplayString(bandCount) + " bands over " +
+         StringUtilities::toDisplayString(count) + " pixels.", 100, NORMAL);
+   }
+   pStep->addProperty("Bands", bandCount);
+   pStep->addProperty("Count", count);
+
+   pOutArgList->setPlugInArgValue("Count", &count);
+   std::vector<double> means = moments.getMeans();
+   pOutArgList->setPlugInArgValue("Means", &means);
+   pOutArgList->setPlugInArgValue("Covariance", &covariance);
+   pOutArgList->setPlugInArgValue("Correlation", &correlation);
+
+   pStep->finalize();
+   return true;
+}
+
+bool Tutorial9::abort()
+{
+   mAborted = 1;
+   return ExecutableShell::abort();
+}
@@ -0,0 +1,31 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2007 Ball Aerospace & Technologies Corporation
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef TUTORIAL9_H
+#define TUTORIAL9_H
+
+#include "ExecutableShell.h"
+#include <QtCore/QAtomicInt>
+
+class Tutorial9 : public ExecutableShell
+{
+public:
+   Tutorial9();
+   virtual ~Tutorial9();
+
+   virtual bool getInputSpecification(PlugInArgList*& pInArgList);
+   virtual bool getOutputSpecification(PlugInArgList*& pOutArgList);
+   virtual bool execute(PlugInArgList* pInArgList, PlugInArgList* pOutArgList);
+   virtual bool abort();
+
+private:
+   QAtomicInt mAborted;
+};
+
+#endif